@@ -0,0 +1,346 @@
+/*
+ * Copyright 2017 Francesco Circhetta
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/****************************************************************************
+ * Included Files
+ ****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+#define USAGE "Usage: %s <workload> [-n <ops>] [-s <seed>] [-c <bytes>] " \
+    "[-o <file>]\n" \
+    "  workloads: wide deep create find delete_r write zipf\n" \
+    "  -n <ops>    commands to generate, about (default 100000)\n" \
+    "  -s <seed>   random seed (default 1)\n" \
+    "  -c <bytes>  content of the write workload (default 4096)\n" \
+    "  -o <file>   output journal (default stdout)\n"
+
+#define DEFAULT_OPS 100000
+#define DEFAULT_CONTENT 4096
+#define DIR_FILES 1000 /* Below the MAX_NODES of a directory */
+#define DEEP_DEPTH 250 /* Below MAX_DEPTH */
+#define TREE_FANOUT 32
+#define FIND_NAMES 64
+#define FIND_RATIO 100
+#define BATCH_DIRS 8
+#define BATCH_FILES 8
+#define WRITE_FILES 1000
+#define ZIPF_FILES 10000
+#define ZIPF_EXPONENT 1.0
+
+/****************************************************************************
+ * Private Types
+ ****************************************************************************/
+/* Journal generator */
+typedef void (*workload_fn)(FILE *, size_t);
+
+typedef struct _workload {
+    const char          *name;
+    workload_fn         generate;
+} workload_t;
+
+/****************************************************************************
+ * Private Data
+ ****************************************************************************/
+static uint64_t rng_state = 1;
+static size_t content_size = DEFAULT_CONTENT;
+
+/****************************************************************************
+ * Private Functions
+ ****************************************************************************/
+/**
+ * Return a pseudo random number (xorshift64*): the same seed gives the
+ * same journal on every platform
+ */
+static uint64_t rng_next(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545f4914f6cdd1dULL;
+}
+
+/**
+ * Return a pseudo random number below n
+ */
+static size_t rng_below(size_t n) {
+    return (size_t) (rng_next() % n);
+}
+
+/**
+ * Print the path of the i-th node of a tree where node i is a child of
+ * node (i - 1) / TREE_FANOUT, node 0 being the root
+ */
+static void tree_path(FILE *out, size_t i) {
+    if (i == 0) return;
+    tree_path(out, (i - 1) / TREE_FANOUT);
+    fprintf(out, "/n%zu", i);
+}
+
+/**
+ * Create the nodes 1 to num - 1 of a tree, see tree_path. Nodes with
+ * children are directories.
+ */
+static void tree_create(FILE *out, size_t num) {
+    for (size_t i = 1; i < num; i++) {
+        fprintf(out, i * TREE_FANOUT + 1 < num ? "create_dir " : "create ");
+        tree_path(out, i);
+        fputc('\n', out);
+    }
+}
+
+/**
+ * Print the path of the depth-th directory of the deep chain
+ */
+static void deep_path(FILE *out, size_t depth) {
+    for (size_t i = 0; i < depth; i++) {
+        fputs("/d", out);
+    }
+}
+
+/**
+ * Many files per directory: create ops / 2 files, a thousand per
+ * directory, then read random ones
+ */
+static void gen_wide(FILE *out, size_t ops) {
+    size_t files = ops / 2 > 0 ? ops / 2 : 1;
+    for (size_t i = 0; i < files; i++) {
+        if (i % DIR_FILES == 0) {
+            fprintf(out, "create_dir /w%zu\n", i / DIR_FILES);
+        }
+        fprintf(out, "create /w%zu/f%zu\n", i / DIR_FILES, i % DIR_FILES);
+    }
+    for (size_t i = files; i < ops; i++) {
+        size_t f = rng_below(files);
+        fprintf(out, "read /w%zu/f%zu\n", f / DIR_FILES, f % DIR_FILES);
+    }
+}
+
+/**
+ * Long paths: a chain of DEEP_DEPTH directories, files created at random
+ * depths, then read back
+ */
+static void gen_deep(FILE *out, size_t ops) {
+    size_t files = ops / 2 > 0 ? ops / 2 : 1;
+    if (files > DEEP_DEPTH * DIR_FILES) {
+        files = DEEP_DEPTH * DIR_FILES;
+    }
+    for (size_t depth = 1; depth <= DEEP_DEPTH; depth++) {
+        fputs("create_dir ", out);
+        deep_path(out, depth);
+        fputc('\n', out);
+    }
+    /* File i lives at depth 1 + i % DEEP_DEPTH */
+    for (size_t i = 0; i < files; i++) {
+        fputs("create ", out);
+        deep_path(out, 1 + i % DEEP_DEPTH);
+        fprintf(out, "/f%zu\n", i);
+    }
+    for (size_t i = DEEP_DEPTH + files; i < ops; i++) {
+        size_t f = rng_below(files);
+        fputs("read ", out);
+        deep_path(out, 1 + f % DEEP_DEPTH);
+        fprintf(out, "/f%zu\n", f);
+    }
+}
+
+/**
+ * Creations only, in a tree of TREE_FANOUT children per directory
+ */
+static void gen_create(FILE *out, size_t ops) {
+    tree_create(out, ops + 1);
+}
+
+/**
+ * Searches: one command in FIND_RATIO builds a tree whose files share
+ * FIND_NAMES names, then finds of random names, with one write every
+ * FIND_RATIO commands to invalidate the results
+ */
+static void gen_find(FILE *out, size_t ops) {
+    size_t nodes = ops / FIND_RATIO + 1, leaves = 0;
+    for (size_t i = 1; i < nodes; i++) {
+        if (i * TREE_FANOUT + 1 < nodes) {
+            fputs("create_dir ", out);
+            tree_path(out, i);
+        } else {
+            /* Siblings are consecutive: their names differ */
+            fputs("create ", out);
+            tree_path(out, (i - 1) / TREE_FANOUT);
+            fprintf(out, "/k%zu", i % FIND_NAMES);
+            leaves = i;
+        }
+        fputc('\n', out);
+    }
+    for (size_t i = nodes; i < ops; i++) {
+        if (i % FIND_RATIO == 0 && leaves > 0) {
+            fputs("write ", out);
+            tree_path(out, (leaves - 1) / TREE_FANOUT);
+            fprintf(out, "/k%zu \"%zu\"\n", leaves % FIND_NAMES, i);
+        } else {
+            fprintf(out, "find k%zu\n", rng_below(FIND_NAMES));
+        }
+    }
+}
+
+/**
+ * Recursive deletions: subtrees of BATCH_DIRS directories of BATCH_FILES
+ * files each are built then deleted at once
+ */
+static void gen_delete_r(FILE *out, size_t ops) {
+    size_t batch = 2 + BATCH_DIRS * (BATCH_FILES + 1);
+    for (size_t n = 0, t = 0; n + batch <= ops || n == 0; n += batch, t++) {
+        fprintf(out, "create_dir /t%zu\n", t);
+        for (size_t d = 0; d < BATCH_DIRS; d++) {
+            fprintf(out, "create_dir /t%zu/d%zu\n", t, d);
+            for (size_t f = 0; f < BATCH_FILES; f++) {
+                fprintf(out, "create /t%zu/d%zu/f%zu\n", t, d, f);
+            }
+        }
+        fprintf(out, "delete_r /t%zu\n", t);
+    }
+}
+
+/**
+ * Large contents: WRITE_FILES files rewritten with content_size bytes
+ * taken at random offsets of a random text
+ */
+static void gen_write(FILE *out, size_t ops) {
+    size_t len = content_size * 2;
+    char *text = malloc(len);
+    if (text == NULL) exit(EXIT_FAILURE);
+    for (size_t i = 0; i < len; i++) {
+        text[i] = (char) ('a' + rng_below(26));
+    }
+    for (size_t i = 0; i < WRITE_FILES; i++) {
+        fprintf(out, "create /f%zu\n", i);
+    }
+    for (size_t i = WRITE_FILES; i < ops; i++) {
+        fprintf(out, "write /f%zu \"%.*s\"\n", rng_below(WRITE_FILES),
+                (int) content_size, text + rng_below(content_size));
+    }
+    free(text);
+}
+
+/**
+ * Skewed popularity: ZIPF_FILES files in directories of DIR_FILES, read
+ * (four times out of five) or written with Zipfian probabilities
+ */
+static void gen_zipf(FILE *out, size_t ops) {
+    double *cdf = malloc(ZIPF_FILES * sizeof(double));
+    size_t *file = malloc(ZIPF_FILES * sizeof(size_t));
+    if (cdf == NULL || file == NULL) exit(EXIT_FAILURE);
+    double sum = 0;
+    for (size_t i = 0; i < ZIPF_FILES; i++) {
+        sum += 1.0 / pow((double) (i + 1), ZIPF_EXPONENT);
+        cdf[i] = sum;
+        file[i] = i;
+    }
+    /* Popular files are scattered across the directories */
+    for (size_t i = ZIPF_FILES - 1; i > 0; i--) {
+        size_t j = rng_below(i + 1), tmp = file[i];
+        file[i] = file[j];
+        file[j] = tmp;
+    }
+    for (size_t i = 0; i < ZIPF_FILES; i++) {
+        if (i % DIR_FILES == 0) {
+            fprintf(out, "create_dir /z%zu\n", i / DIR_FILES);
+        }
+        fprintf(out, "create /z%zu/f%zu\n", i / DIR_FILES, i % DIR_FILES);
+    }
+    for (size_t i = ZIPF_FILES + ZIPF_FILES / DIR_FILES; i < ops; i++) {
+        /* Smallest rank whose cumulative weight reaches u */
+        double u = (double) (rng_next() >> 11) / 9007199254740992.0 * sum;
+        size_t lo = 0, hi = ZIPF_FILES - 1;
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (cdf[mid] < u) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        size_t f = file[lo];
+        if (rng_below(5) == 0) {
+            fprintf(out, "write /z%zu/f%zu \"%zu\"\n", f / DIR_FILES,
+                    f % DIR_FILES, i);
+        } else {
+            fprintf(out, "read /z%zu/f%zu\n", f / DIR_FILES, f % DIR_FILES);
+        }
+    }
+    free(file);
+    free(cdf);
+}
+
+static const workload_t workloads[] = {
+    {"wide", gen_wide},
+    {"deep", gen_deep},
+    {"create", gen_create},
+    {"find", gen_find},
+    {"delete_r", gen_delete_r},
+    {"write", gen_write},
+    {"zipf", gen_zipf},
+};
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+int main(int argc, char *argv[]) {
+    const workload_t *workload = NULL;
+    size_t ops = DEFAULT_OPS;
+    FILE *out = stdout;
+    for (size_t i = 0; argc > 1 && i < sizeof(workloads) / sizeof(workloads[0]);
+         i++) {
+        if (strcmp(argv[1], workloads[i].name) == 0) {
+            workload = &workloads[i];
+        }
+    }
+    if (workload == NULL) {
+        fprintf(stderr, USAGE, argv[0]);
+        return EXIT_FAILURE;
+    }
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            ops = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            rng_state = strtoull(argv[++i], NULL, 10);
+            if (rng_state == 0) rng_state = 1;
+        } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            content_size = strtoul(argv[++i], NULL, 10);
+            if (content_size == 0) content_size = 1;
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            if ((out = fopen(argv[++i], "w")) == NULL) {
+                perror(argv[i]);
+                return EXIT_FAILURE;
+            }
+        } else {
+            fprintf(stderr, USAGE, argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    workload->generate(out, ops);
+    fputs("exit\n", out);
+    if (fclose(out) != 0) {
+        perror("bench-gen");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
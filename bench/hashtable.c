@@ -0,0 +1,312 @@
+/*
+ * Copyright 2017 Francesco Circhetta
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/****************************************************************************
+ * Included Files
+ ****************************************************************************/
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_RDTSC
+#endif
+#include "utils.h"
+#include "hashtable.h"
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+#define USAGE "Usage: %s [-r <repetitions>] [-o <ops>]\n" \
+    "  -r <n>    timed repetitions of every case, after a warmup (default 7)\n" \
+    "  -o <n>    operations per repetition, about (default 200000)\n"
+
+#define DEFAULT_REPS 7
+#define DEFAULT_OPS 200000
+#define MAX_KEY 128
+
+/****************************************************************************
+ * Private Types
+ ****************************************************************************/
+/* Operations under test */
+enum {
+    OpInsert,
+    OpHit,
+    OpMiss,
+    OpRemove,
+    OpIterate,
+    OpResize,
+    OpCount
+};
+
+/* Key length distribution */
+typedef struct _key_lengths {
+    const char          *name;
+    size_t              min;
+    size_t              max;
+} key_lengths_t;
+
+/* Time and cycles spent on a number of operations */
+typedef struct _sample {
+    uint64_t            ns;
+    uint64_t            cycles;
+    uint64_t            ops;
+} sample_t;
+
+/****************************************************************************
+ * Private Data
+ ****************************************************************************/
+static const char *op_names[] = {
+    [OpInsert] = "insert",
+    [OpHit] = "hit",
+    [OpMiss] = "miss",
+    [OpRemove] = "remove",
+    [OpIterate] = "iterate",
+    [OpResize] = "resize",
+};
+
+/* Entries per table: the largest stays below the last resize of a
+ * 16 bit capacity */
+static const size_t sizes[] = {16, 256, 4096, 24000};
+
+static const key_lengths_t key_lengths[] = {
+    {"short", 4, 8},
+    {"medium", 16, 32},
+    {"long", 64, 128},
+};
+
+/* Load factors reached after the inserts, below the resize threshold */
+static const double loads[] = {0.25, 0.5, 0.75};
+
+static uint64_t rng_state = 1;
+
+/****************************************************************************
+ * Private Functions
+ ****************************************************************************/
+/**
+ * Return a pseudo random number (xorshift64*)
+ */
+static uint64_t rng_next(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545f4914f6cdd1dULL;
+}
+
+/**
+ * Return a monotonic clock, in nanoseconds
+ */
+static inline uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+/**
+ * Return the time stamp counter, 0 where there is none. It ticks at a
+ * constant rate on recent x86, close to the nominal frequency.
+ */
+static inline uint64_t now_cycles(void) {
+#ifdef HAVE_RDTSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+/**
+ * Fill keys with num distinct random strings of the given lengths.
+ * The first character tells apart the keys of different sets.
+ */
+static void make_keys(char **keys, size_t num, const key_lengths_t *lengths,
+                      char set) {
+    for (size_t i = 0; i < num; i++) {
+        size_t len = lengths->min + rng_next() % (lengths->max - lengths->min + 1);
+        char *key = keys[i];
+        /* The index makes the keys distinct */
+        int prefix = snprintf(key, MAX_KEY, "%c%zx.", set, i);
+        for (size_t j = (size_t) prefix; j < len; j++) {
+            key[j] = (char) ('a' + rng_next() % 26);
+        }
+        key[len > (size_t) prefix ? len : (size_t) prefix] = '\0';
+    }
+}
+
+/**
+ * Shuffle an array of keys (Fisher-Yates)
+ */
+static void shuffle(char **keys, size_t num) {
+    for (size_t i = num - 1; i > 0; i--) {
+        size_t j = rng_next() % (i + 1);
+        char *tmp = keys[i];
+        keys[i] = keys[j];
+        keys[j] = tmp;
+    }
+}
+
+/**
+ * Return a table of the given capacity holding the keys
+ */
+static hashtable_t *build(char **keys, size_t num, uint16_t capacity) {
+    hashtable_t *t = hashtable_create();
+    hashtable_resize(t, capacity);
+    for (size_t i = 0; i < num; i++) {
+        hashtable_set(t, keys[i], keys[i]);
+    }
+    return t;
+}
+
+/**
+ * Run an operation on enough tables of num keys to reach about ops
+ * operations, timing only the operation itself
+ */
+static sample_t run(int op, char **keys, char **missing, size_t num,
+                    uint16_t capacity, size_t ops) {
+    sample_t sample = {0, 0, 0};
+    size_t rounds = ops / num > 0 ? ops / num : 1;
+    volatile uintptr_t sink = 0;
+    for (size_t r = 0; r < rounds; r++) {
+        hashtable_t *t = op == OpInsert ? hashtable_create() : NULL;
+        if (op == OpInsert) {
+            hashtable_resize(t, capacity);
+        } else {
+            t = build(keys, num, capacity);
+        }
+        uint64_t start = now_ns(), cycles = now_cycles();
+        switch (op) {
+            case OpInsert:
+                for (size_t i = 0; i < num; i++) {
+                    hashtable_set(t, keys[i], keys[i]);
+                }
+                break;
+            case OpHit:
+                for (size_t i = 0; i < num; i++) {
+                    sink += (uintptr_t) hashtable_get(t, keys[num - 1 - i]);
+                }
+                break;
+            case OpMiss:
+                for (size_t i = 0; i < num; i++) {
+                    sink += (uintptr_t) hashtable_get(t, missing[i]);
+                }
+                break;
+            case OpRemove:
+                for (size_t i = 0; i < num; i++) {
+                    hashtable_remove(t, keys[num - 1 - i]);
+                }
+                break;
+            case OpIterate: {
+                size_t state = 0;
+                void *value;
+                while ((value = hashtable_iterate(t, &state)) != NULL) {
+                    sink += (uintptr_t) value;
+                }
+                break;
+            }
+            case OpResize:
+                /* Double, past the load */
+                hashtable_resize(t, capacity <= UINT16_MAX / 2
+                                    ? (uint16_t) (capacity * 2) : UINT16_MAX);
+                break;
+            default:
+                break;
+        }
+        sample.cycles += now_cycles() - cycles;
+        sample.ns += now_ns() - start;
+        sample.ops += num;
+        hashtable_destroy(t);
+    }
+    (void) sink;
+    return sample;
+}
+
+/**
+ * Compare two per-operation times
+ */
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+int main(int argc, char *argv[]) {
+    size_t reps = DEFAULT_REPS, ops = DEFAULT_OPS;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            reps = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            ops = strtoul(argv[++i], NULL, 10);
+        } else {
+            fprintf(stderr, USAGE, argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (reps == 0) reps = 1;
+    size_t max_size = sizes[sizeof(sizes) / sizeof(sizes[0]) - 1];
+    char **keys = malloc_or_die(max_size * sizeof(char *));
+    char **missing = malloc_or_die(max_size * sizeof(char *));
+    for (size_t i = 0; i < max_size; i++) {
+        keys[i] = malloc_or_die(MAX_KEY);
+        missing[i] = malloc_or_die(MAX_KEY);
+    }
+    double *ns = malloc_or_die(reps * sizeof(double));
+    double *cycles = malloc_or_die(reps * sizeof(double));
+    printf("%-8s %6s %-7s %5s %10s %10s %10s %10s\n", "op", "size", "keys",
+           "load", "ns_min", "ns_median", "ns_max", "cycles");
+    for (size_t k = 0; k < sizeof(key_lengths) / sizeof(key_lengths[0]); k++) {
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+            size_t num = sizes[s];
+            make_keys(keys, num, &key_lengths[k], 'k');
+            make_keys(missing, num, &key_lengths[k], 'm');
+            shuffle(keys, num);
+            for (size_t l = 0; l < sizeof(loads) / sizeof(loads[0]); l++) {
+                double capacity = (double) num / loads[l] + 0.5;
+                if (capacity > UINT16_MAX) continue; /* Too large a table */
+                for (int op = 0; op < OpCount; op++) {
+                    /* Warmup */
+                    run(op, keys, missing, num, (uint16_t) capacity, ops);
+                    for (size_t r = 0; r < reps; r++) {
+                        sample_t sample = run(op, keys, missing, num,
+                                              (uint16_t) capacity, ops);
+                        ns[r] = (double) sample.ns / (double) sample.ops;
+                        cycles[r] = (double) sample.cycles / (double) sample.ops;
+                    }
+                    qsort(ns, reps, sizeof(double), compare_double);
+                    qsort(cycles, reps, sizeof(double), compare_double);
+                    printf("%-8s %6zu %-7s %5.2f %10.2f %10.2f %10.2f %10.2f\n",
+                           op_names[op], num, key_lengths[k].name, loads[l],
+                           ns[0], ns[reps / 2], ns[reps - 1],
+                           cycles[reps / 2]);
+                    fflush(stdout);
+                }
+            }
+        }
+    }
+    for (size_t i = 0; i < max_size; i++) {
+        my_free(keys[i]);
+        my_free(missing[i]);
+    }
+    my_free(keys);
+    my_free(missing);
+    my_free(ns);
+    my_free(cycles);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,500 @@
+/*
+ * Copyright 2017 Francesco Circhetta
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/****************************************************************************
+ * Included Files
+ ****************************************************************************/
+#ifdef __linux__
+#define _GNU_SOURCE /* ppoll */
+#else
+#define _POSIX_C_SOURCE 200809L
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+#include "histogram.h"
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+#define USAGE "Usage: %s <project> [-r <rates>] [-d <seconds>] " \
+    "[-c <connections>] [-m <mix>] [-k <files>] [-s <seed>]\n" \
+    "  -r <rates>  requests per second, comma separated\n" \
+    "              (default 10000,50000,100000,200000,400000)\n" \
+    "  -d <s>      seconds per rate (default 2)\n" \
+    "  -c <n>      connections, one tenant each (default 16)\n" \
+    "  -m <mix>    operation weights, among read, write, create and delete\n" \
+    "              (default read=70,write=20,create=5,delete=5)\n" \
+    "  -k <n>      files per connection, at most 1000 (default 1000)\n" \
+    "  -s <seed>   random seed (default 1)\n"
+
+#define DEFAULT_RATES "10000,50000,100000,200000,400000"
+#define DEFAULT_SECONDS 2
+#define DEFAULT_CONNECTIONS 16
+#define DEFAULT_MIX "read=70,write=20,create=5,delete=5"
+#define DEFAULT_FILES 1000
+#define MAX_REQUEST 128
+#define READ_CHUNK 65536
+
+/****************************************************************************
+ * Private Types
+ ****************************************************************************/
+/* Operations of the mix */
+enum {
+    OpRead,
+    OpWrite,
+    OpCreate,
+    OpDelete,
+    OpCount
+};
+
+/* Requests not written to the project yet */
+typedef struct _buffer {
+    char                *data;
+    size_t              head;           /* First byte not written */
+    size_t              len;
+    size_t              capacity;
+} buffer_t;
+
+/* The project under load */
+typedef struct _server {
+    pid_t               pid;
+    int                 in;             /* Its stdin, non blocking */
+    int                 out;            /* Its stdout */
+    buffer_t            pending;
+    uint64_t            written;        /* Bytes written so far */
+} server_t;
+
+/* Schedule of the requests of a run */
+typedef struct _schedule {
+    uint64_t            *intended;      /* When they were due */
+    uint64_t            *sent;          /* When they were fully written */
+    uint64_t            *end;           /* Offset of their last byte + 1 */
+    size_t              queued;
+    size_t              stamped;        /* Requests with a sent time */
+    uint64_t            bytes;          /* Bytes queued so far */
+} schedule_t;
+
+/****************************************************************************
+ * Private Data
+ ****************************************************************************/
+static const char *op_names[] = {
+    [OpRead] = "read",
+    [OpWrite] = "write",
+    [OpCreate] = "create",
+    [OpDelete] = "delete",
+};
+
+static uint64_t rng_state = 1;
+
+/****************************************************************************
+ * Private Functions
+ ****************************************************************************/
+/**
+ * Return a pseudo random number (xorshift64*)
+ */
+static uint64_t rng_next(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545f4914f6cdd1dULL;
+}
+
+/**
+ * Return a monotonic clock, in nanoseconds
+ */
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+/**
+ * Allocate or die
+ */
+static void *xrealloc(void *ptr, size_t size) {
+    if ((ptr = realloc(ptr, size)) == NULL) {
+        perror("bench-load");
+        exit(EXIT_FAILURE);
+    }
+    return ptr;
+}
+
+/**
+ * Append len bytes to a buffer
+ */
+static void buffer_append(buffer_t *b, const char *data, size_t len) {
+    if (b->head > 0 && b->len + len > b->capacity) {
+        /* Drop what was written */
+        memmove(b->data, b->data + b->head, b->len - b->head);
+        b->len -= b->head;
+        b->head = 0;
+    }
+    if (b->len + len > b->capacity) {
+        b->capacity = (b->len + len) * 2;
+        b->data = xrealloc(b->data, b->capacity);
+    }
+    memcpy(b->data + b->len, data, len);
+    b->len += len;
+}
+
+/**
+ * Parse a mix such as "read=70,write=30" into weights, by operation.
+ * Return false if it is malformed or all weights are 0.
+ */
+static bool parse_mix(char *mix, unsigned weights[OpCount]) {
+    unsigned total = 0;
+    memset(weights, 0, OpCount * sizeof(unsigned));
+    for (char *item = strtok(mix, ","); item != NULL; item = strtok(NULL, ",")) {
+        char *eq = strchr(item, '=');
+        int op = 0;
+        if (eq == NULL) return false;
+        *eq = '\0';
+        while (op < OpCount && strcmp(item, op_names[op]) != 0) op++;
+        if (op == OpCount) return false;
+        weights[op] = (unsigned) strtoul(eq + 1, NULL, 10);
+        total += weights[op];
+    }
+    return total > 0;
+}
+
+/**
+ * Start the project with its standard input and output on pipes
+ */
+static bool server_start(server_t *s, const char *project) {
+    int to[2], from[2];
+    memset(s, 0, sizeof(server_t));
+    if (pipe(to) != 0) {
+        perror("pipe");
+        return false;
+    }
+    if (pipe(from) != 0) {
+        perror("pipe");
+        close(to[0]);
+        close(to[1]);
+        return false;
+    }
+    if ((s->pid = fork()) == 0) {
+        dup2(to[0], STDIN_FILENO);
+        dup2(from[1], STDOUT_FILENO);
+        close(to[0]);
+        close(to[1]);
+        close(from[0]);
+        close(from[1]);
+        execl(project, project, (char *) NULL);
+        perror(project);
+        _exit(127);
+    }
+    close(to[0]);
+    close(from[1]);
+    if (s->pid < 0) {
+        perror("fork");
+        close(to[1]);
+        close(from[0]);
+        return false;
+    }
+    s->in = to[1];
+    s->out = from[0];
+    fcntl(s->in, F_SETFL, fcntl(s->in, F_GETFL) | O_NONBLOCK);
+    return true;
+}
+
+/**
+ * Close the input of the project and wait for it to exit
+ */
+static bool server_stop(server_t *s) {
+    int status;
+    close(s->in);
+    close(s->out);
+    free(s->pending.data);
+    return waitpid(s->pid, &status, 0) == s->pid && WIFEXITED(status)
+           && WEXITSTATUS(status) == 0;
+}
+
+/**
+ * Write as much of the pending requests as the pipe takes.
+ * Return false if the project is gone.
+ */
+static bool server_write(server_t *s) {
+    buffer_t *b = &s->pending;
+    while (b->head < b->len) {
+        ssize_t n = write(s->in, b->data + b->head, b->len - b->head);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return errno == EAGAIN;
+        }
+        b->head += (size_t) n;
+        s->written += (uint64_t) n;
+    }
+    b->head = b->len = 0;
+    return true;
+}
+
+/**
+ * Wait up to timeout nanoseconds (forever if negative) for responses,
+ * and return the number of lines read, -1 if the project is gone
+ */
+static long server_read(server_t *s, int64_t timeout) {
+    struct pollfd fds[2] = {
+        {s->out, POLLIN, 0},
+        {s->in, POLLOUT, 0},
+    };
+    char chunk[READ_CHUNK];
+    long lines = 0;
+    nfds_t nfds = s->pending.head < s->pending.len ? 2 : 1;
+#ifdef __linux__
+    /* Wake up on time for the next request, without spinning */
+    struct timespec ts = {(time_t) (timeout / 1000000000),
+                          (long) (timeout % 1000000000)};
+    int ready = ppoll(fds, nfds, timeout < 0 ? NULL : &ts, NULL);
+#else
+    int ready = poll(fds, nfds, timeout < 0 ? -1
+                     : (int) ((timeout + 999999) / 1000000));
+#endif
+    if (ready < 0) {
+        return errno == EINTR ? 0 : -1;
+    }
+    if (fds[0].revents & (POLLIN | POLLHUP)) {
+        ssize_t n = read(s->out, chunk, sizeof(chunk));
+        if (n <= 0) return n < 0 && errno == EINTR ? 0 : -1;
+        for (char *c = chunk; (c = memchr(c, '\n', (size_t) (chunk + n - c)));
+             c++) {
+            lines++;
+        }
+    }
+    return lines;
+}
+
+/**
+ * Create the files of every connection, and wait for the responses
+ */
+static bool setup(server_t *s, unsigned connections, unsigned files) {
+    char request[MAX_REQUEST];
+    long expected = 0;
+    for (unsigned c = 0; c < connections; c++) {
+        int len = snprintf(request, sizeof(request),
+                           "tenant c%u create_dir /d\ntenant c%u create_dir /e\n",
+                           c, c);
+        buffer_append(&s->pending, request, (size_t) len);
+        expected += 2;
+        for (unsigned f = 0; f < files; f++) {
+            len = snprintf(request, sizeof(request),
+                           "tenant c%u create /d/f%u\n", c, f);
+            buffer_append(&s->pending, request, (size_t) len);
+            expected++;
+        }
+    }
+    while (expected > 0) {
+        long lines;
+        if (!server_write(s) || (lines = server_read(s, -1)) < 0)
+            return false;
+        expected -= lines;
+    }
+    return true;
+}
+
+/**
+ * Queue a random request of the mix
+ */
+static void queue_request(server_t *s, const unsigned weights[OpCount],
+                          unsigned total, unsigned connections,
+                          unsigned files, size_t seq) {
+    char request[MAX_REQUEST];
+    unsigned c = (unsigned) (rng_next() % connections);
+    unsigned f = (unsigned) (rng_next() % files);
+    unsigned pick = (unsigned) (rng_next() % total);
+    int op = 0, len = 0;
+    while (pick >= weights[op]) pick -= weights[op++];
+    switch (op) {
+        case OpRead:
+            len = snprintf(request, sizeof(request),
+                           "tenant c%u read /d/f%u\n", c, f);
+            break;
+        case OpWrite:
+            len = snprintf(request, sizeof(request),
+                           "tenant c%u write /d/f%u \"%zu\"\n", c, f, seq);
+            break;
+        case OpCreate:
+            len = snprintf(request, sizeof(request),
+                           "tenant c%u create /e/g%u\n", c, f);
+            break;
+        case OpDelete:
+            len = snprintf(request, sizeof(request),
+                           "tenant c%u delete /e/g%u\n", c, f);
+            break;
+        default:
+            break;
+    }
+    buffer_append(&s->pending, request, (size_t) len);
+}
+
+/**
+ * Release the schedule and the histograms of a run
+ */
+static void run_free(schedule_t *sched, histogram_t *corrected,
+                     histogram_t *uncorrected) {
+    free(sched->intended);
+    free(sched->sent);
+    free(sched->end);
+    free(corrected);
+    free(uncorrected);
+}
+
+/**
+ * Drive a fresh project at rate requests per second for the given time,
+ * and print a line of results
+ */
+static bool run(const char *project, unsigned long rate, unsigned seconds,
+                unsigned connections, unsigned files,
+                const unsigned weights[OpCount]) {
+    server_t server;
+    schedule_t sched;
+    histogram_t *corrected = calloc(1, sizeof(histogram_t));
+    histogram_t *uncorrected = calloc(1, sizeof(histogram_t));
+    size_t total = (size_t) rate * seconds, received = 0;
+    unsigned weight = 0;
+    memset(&sched, 0, sizeof(sched));
+    if (corrected == NULL || uncorrected == NULL || total == 0) {
+        run_free(&sched, corrected, uncorrected);
+        return false;
+    }
+    for (int op = 0; op < OpCount; op++) weight += weights[op];
+    sched.intended = xrealloc(NULL, total * sizeof(uint64_t));
+    sched.sent = xrealloc(NULL, total * sizeof(uint64_t));
+    sched.end = xrealloc(NULL, total * sizeof(uint64_t));
+    bool started = server_start(&server, project);
+    if (!started || !setup(&server, connections, files)) {
+        fprintf(stderr, "bench-load: %s failed\n", project);
+        if (started) {
+            /* Closing its input lets the project exit */
+            server_stop(&server);
+        }
+        run_free(&sched, corrected, uncorrected);
+        return false;
+    }
+    uint64_t interval = 1000000000u / rate, start = now_ns(), now = start;
+    while (received < total) {
+        now = now_ns();
+        /* Open loop: requests are due on schedule, answered or not */
+        while (sched.queued < total
+               && start + sched.queued * interval <= now) {
+            queue_request(&server, weights, weight, connections, files,
+                          sched.queued);
+            sched.intended[sched.queued] = start + sched.queued * interval;
+            sched.bytes = server.written + server.pending.len
+                          - server.pending.head;
+            sched.end[sched.queued++] = sched.bytes;
+        }
+        if (!server_write(&server)) break;
+        now = now_ns();
+        while (sched.stamped < sched.queued
+               && sched.end[sched.stamped] <= server.written) {
+            sched.sent[sched.stamped++] = now;
+        }
+        int64_t timeout = -1;
+        if (sched.queued < total) {
+            uint64_t due = start + sched.queued * interval;
+            timeout = due > now ? (int64_t) (due - now) : 0;
+        }
+        long lines = server_read(&server, timeout);
+        if (lines < 0) break;
+        now = now_ns();
+        for (; lines > 0 && received < sched.stamped; lines--, received++) {
+            /* From when the request was due: stalls are not hidden by
+             * the requests that were not sent meanwhile */
+            hist_record(corrected, now - sched.intended[received]);
+            hist_record(uncorrected, now - sched.sent[received]);
+        }
+    }
+    bool ok = server_stop(&server) && received == total;
+    if (ok) {
+        printf("%8lu %9.0f %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f\n", rate,
+               (double) total * 1e9 / (double) (now - start),
+               hist_percentile(corrected, 0.5) / 1e3,
+               hist_percentile(corrected, 0.9) / 1e3,
+               hist_percentile(corrected, 0.99) / 1e3,
+               hist_percentile(corrected, 0.999) / 1e3,
+               corrected->max / 1e3,
+               hist_percentile(uncorrected, 0.99) / 1e3);
+        fflush(stdout);
+    } else {
+        fprintf(stderr, "bench-load: %s failed at %lu/s\n", project, rate);
+    }
+    run_free(&sched, corrected, uncorrected);
+    return ok;
+}
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+int main(int argc, char *argv[]) {
+    char rates_default[] = DEFAULT_RATES, mix_default[] = DEFAULT_MIX;
+    char *rates = rates_default, *mix = mix_default;
+    unsigned seconds = DEFAULT_SECONDS, connections = DEFAULT_CONNECTIONS;
+    unsigned files = DEFAULT_FILES, weights[OpCount];
+    int i;
+    for (i = 2; i < argc; i++) {
+        if (i + 1 >= argc) break;
+        if (strcmp(argv[i], "-r") == 0) {
+            rates = argv[++i];
+        } else if (strcmp(argv[i], "-d") == 0) {
+            seconds = (unsigned) strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-c") == 0) {
+            connections = (unsigned) strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-m") == 0) {
+            mix = argv[++i];
+        } else if (strcmp(argv[i], "-k") == 0) {
+            files = (unsigned) strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-s") == 0) {
+            rng_state = strtoull(argv[++i], NULL, 10);
+            if (rng_state == 0) rng_state = 1;
+        } else {
+            break;
+        }
+    }
+    if (argc < 2 || i < argc || seconds == 0 || connections == 0
+        || files == 0 || files > DEFAULT_FILES || !parse_mix(mix, weights)) {
+        fprintf(stderr, USAGE, argv[0]);
+        return EXIT_FAILURE;
+    }
+    signal(SIGPIPE, SIG_IGN);
+#ifdef __linux__
+    /* Requests leave on time, not up to 50us late */
+    prctl(PR_SET_TIMERSLACK, 1UL, 0UL, 0UL, 0UL);
+#endif
+    printf("%8s %9s %9s %9s %9s %9s %9s %9s\n", "rate", "achieved",
+           "p50_us", "p90_us", "p99_us", "p999_us", "max_us", "p99_sent");
+    for (char *rate = strtok(rates, ","); rate != NULL;
+         rate = strtok(NULL, ",")) {
+        unsigned long r = strtoul(rate, NULL, 10);
+        if (r == 0 || !run(argv[1], r, seconds, connections, files, weights))
+            return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
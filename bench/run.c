@@ -0,0 +1,190 @@
+/*
+ * Copyright 2017 Francesco Circhetta
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/****************************************************************************
+ * Included Files
+ ****************************************************************************/
+#define _DEFAULT_SOURCE /* wait4 */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+#define USAGE "Usage: %s <project> <journal>...\n" \
+    "  replay every journal with a fresh project and print, per journal,\n" \
+    "  \"<name>.<key> <value>\" lines: <command>.count and\n" \
+    "  <command>.ns_per_op, then ops, seconds, ops_per_sec and peak_rss_kb\n"
+
+#define LATENCY_PREFIX "latency."
+#define REPORT_CHUNK 4096
+
+/****************************************************************************
+ * Private Functions
+ ****************************************************************************/
+/**
+ * Return a monotonic clock, in nanoseconds
+ */
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+/**
+ * Return the name of a journal: its file name without directory and
+ * extension
+ */
+static char *journal_name(const char *path) {
+    const char *base = strrchr(path, '/');
+    base = base != NULL ? base + 1 : path;
+    char *name = strdup(base);
+    if (name == NULL) exit(EXIT_FAILURE);
+    char *dot = strrchr(name, '.');
+    if (dot != NULL && dot != name) *dot = '\0';
+    return name;
+}
+
+/**
+ * Replay a journal with the project, its responses discarded, and return
+ * the statistics it printed on exit (-S), or NULL on failure.
+ * ns and rss_kb get the elapsed time and the peak resident set size.
+ */
+static char *replay(const char *project, const char *journal, uint64_t *ns,
+                    long *rss_kb) {
+    int in = open(journal, O_RDONLY);
+    int fds[2];
+    if (in < 0) {
+        perror(journal);
+        return NULL;
+    }
+    if (pipe(fds) != 0) {
+        perror("pipe");
+        close(in);
+        return NULL;
+    }
+    uint64_t start = now_ns();
+    pid_t pid = fork();
+    if (pid == 0) {
+        int null = open("/dev/null", O_WRONLY);
+        dup2(in, STDIN_FILENO);
+        dup2(null, STDOUT_FILENO);
+        dup2(fds[1], STDERR_FILENO);
+        close(fds[0]);
+        execl(project, project, "-S", (char *) NULL);
+        perror(project);
+        _exit(127);
+    }
+    close(in);
+    close(fds[1]);
+    if (pid < 0) {
+        perror("fork");
+        close(fds[0]);
+        return NULL;
+    }
+    /* Collect the report while the project runs */
+    size_t len = 0, capacity = REPORT_CHUNK;
+    char *report = malloc(capacity);
+    ssize_t n;
+    if (report == NULL) exit(EXIT_FAILURE);
+    while ((n = read(fds[0], report + len, capacity - len - 1)) > 0) {
+        len += (size_t) n;
+        if (capacity - len == 1) {
+            capacity *= 2;
+            if ((report = realloc(report, capacity)) == NULL)
+                exit(EXIT_FAILURE);
+        }
+    }
+    report[len] = '\0';
+    close(fds[0]);
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) != pid
+        || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "%s: %s failed\n", journal, project);
+        free(report);
+        return NULL;
+    }
+    *ns = now_ns() - start;
+    *rss_kb = usage.ru_maxrss;
+    return report;
+}
+
+/**
+ * Print the results of a journal from the statistics of its replay
+ */
+static void print_results(const char *name, char *report, uint64_t ns,
+                          long rss_kb) {
+    unsigned long long ops = 0;
+    char *line, *save = NULL;
+    /* Commands in the order of the report */
+    for (line = strtok_r(report, "\n", &save); line != NULL;
+         line = strtok_r(NULL, "\n", &save)) {
+        char command[64];
+        unsigned long long value;
+        if (strncmp(line, LATENCY_PREFIX, strlen(LATENCY_PREFIX)) != 0)
+            continue;
+        if (sscanf(line, LATENCY_PREFIX "%63[^.].count %llu", command,
+                   &value) == 2) {
+            printf("%s.%s.count %llu\n", name, command, value);
+            ops += value;
+        } else if (sscanf(line, LATENCY_PREFIX "%63[^.].mean %llu", command,
+                          &value) == 2) {
+            printf("%s.%s.ns_per_op %llu\n", name, command, value);
+        }
+    }
+    printf("%s.ops %llu\n", name, ops);
+    printf("%s.seconds %.3f\n", name, (double) ns / 1e9);
+    printf("%s.ops_per_sec %.0f\n", name,
+           ns > 0 ? (double) ops * 1e9 / (double) ns : 0.0);
+    printf("%s.peak_rss_kb %ld\n", name, rss_kb);
+}
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+int main(int argc, char *argv[]) {
+    int failures = 0;
+    if (argc < 3) {
+        fprintf(stderr, USAGE, argv[0]);
+        return EXIT_FAILURE;
+    }
+    for (int i = 2; i < argc; i++) {
+        uint64_t ns = 0;
+        long rss_kb = 0;
+        char *report = replay(argv[1], argv[i], &ns, &rss_kb);
+        if (report == NULL) {
+            failures++;
+            continue;
+        }
+        char *name = journal_name(argv[i]);
+        print_results(name, report, ns, rss_kb);
+        fflush(stdout);
+        free(name);
+        free(report);
+    }
+    return failures > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
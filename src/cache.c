@@ -0,0 +1,100 @@
+/*
+ * Copyright 2017 Francesco Circhetta
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/****************************************************************************
+ * Included Files
+ ****************************************************************************/
+#include <string.h>
+
+#include "utils.h"
+#include "hashtable.h"
+#include "cache.h"
+
+/****************************************************************************
+ * Private Functions
+ ****************************************************************************/
+/**
+ * Release the result held by a slot
+ */
+static void cache_clear(cache_entry_t *entry) {
+    for (size_t i = 0; i < entry->num; i++) {
+        my_free(entry->paths[i]);
+    }
+    my_free(entry->paths);
+    my_free(entry->name);
+    entry->name = NULL;
+}
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+/**
+ * Create a new, empty cache
+ */
+cache_t *cache_create(void) {
+    return calloc_or_die(1, sizeof(cache_t));
+}
+
+/**
+ * Look up the result of finding name below start. The result is reused only
+ * if it was built after the last change to the tree, whose clock is given
+ * by changed: a change stamped with the same clock may have come later.
+ * Return true if found, with the paths still owned by the cache.
+ */
+bool cache_get(cache_t *c, char *name, struct _node *start, uint32_t changed,
+               char ***paths, size_t *num) {
+    cache_entry_t *entry = &c->body[hashtable_hash(name) % CACHE_SLOTS];
+    if (entry->name != NULL && entry->start == start
+        && entry->clock > changed && strcmp(entry->name, name) == 0) {
+        *paths = entry->paths;
+        *num = entry->num;
+        c->hits++;
+        return true;
+    }
+    c->misses++;
+    return false;
+}
+
+/**
+ * Store the result of finding name below start, built at the given clock,
+ * evicting the result in the same slot. Takes ownership of the paths.
+ */
+void cache_put(cache_t *c, char *name, struct _node *start, uint32_t clock,
+               char **paths, size_t num) {
+    cache_entry_t *entry = &c->body[hashtable_hash(name) % CACHE_SLOTS];
+    if (entry->name != NULL) {
+        cache_clear(entry);
+    }
+    entry->name = my_strdup(name);
+    entry->start = start;
+    entry->clock = clock;
+    entry->paths = paths;
+    entry->num = num;
+}
+
+/**
+ * Destroy the cache and every result it holds
+ */
+void cache_destroy(cache_t *c) {
+    for (size_t i = 0; i < CACHE_SLOTS; i++) {
+        if (c->body[i].name != NULL) {
+            cache_clear(&c->body[i]);
+        }
+    }
+    my_free(c);
+}
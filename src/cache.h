@@ -0,0 +1,64 @@
+/*
+ * Copyright 2017 Francesco Circhetta
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef API_CACHE_H
+#define API_CACHE_H
+
+/****************************************************************************
+ * Included Files
+ ****************************************************************************/
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+#define CACHE_SLOTS 64
+
+/****************************************************************************
+* Public Types
+****************************************************************************/
+struct _node;
+
+/* Result of a find, as sorted full paths */
+typedef struct _cache_entry {
+    char                *name;          /* NULL if the slot is free */
+    struct _node        *start;
+    uint32_t            clock;          /* Clock when the result was built */
+    char                **paths;
+    size_t              num;
+} cache_entry_t;
+
+/* Direct-mapped cache of find results, by name */
+typedef struct _cache {
+    cache_entry_t       body[CACHE_SLOTS];
+    uint64_t            hits;
+    uint64_t            misses;
+} cache_t;
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+cache_t *cache_create(void);
+bool cache_get(cache_t *, char *, struct _node *, uint32_t, char ***,
+               size_t *);
+void cache_put(cache_t *, char *, struct _node *, uint32_t, char **, size_t);
+void cache_destroy(cache_t *);
+
+#endif //API_CACHE_H
@@ -0,0 +1,149 @@
+/*
+ * Copyright 2017 Francesco Circhetta
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/****************************************************************************
+ * Included Files
+ ****************************************************************************/
+#include "simplefs.h"
+#include "handle.h"
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+#define HANDLE_INITIAL_CAPACITY 16
+#define HANDLE_MAX_SLOTS UINT16_MAX
+#define HANDLE_NO_SLOT UINT16_MAX
+
+/* A handle packs the slot index with the slot generation */
+#define HANDLE_MAKE(slot, gen) (((uint32_t) (gen) << 16) | (slot))
+#define HANDLE_SLOT(h) ((h) & 0xffff)
+#define HANDLE_GEN(h) ((h) >> 16)
+
+/****************************************************************************
+ * Private Functions
+ ****************************************************************************/
+/**
+ * Return the entry a handle refers to, or NULL if the handle is stale
+ */
+static handle_entry_t *handle_lookup(handle_table_t *t, uint32_t handle) {
+    uint32_t slot = HANDLE_SLOT(handle);
+    if (slot >= t->size) return NULL;
+    handle_entry_t *entry = t->body[slot];
+    if (entry->node == NULL || entry->generation != HANDLE_GEN(handle))
+        return NULL;
+    return entry;
+}
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+/**
+ * Create a new, empty handle table
+ */
+handle_table_t *handle_table_create(void) {
+    handle_table_t *t = malloc_or_die(sizeof(handle_table_t));
+    t->size = 0;
+    t->capacity = HANDLE_INITIAL_CAPACITY;
+    t->free_head = HANDLE_NO_SLOT;
+    t->body = malloc_or_die(t->capacity * sizeof(handle_entry_t *));
+    return t;
+}
+
+/**
+ * Return a handle to the given node, HANDLE_NONE if the table is full.
+ * A node has at most one handle: opening it again returns the same one.
+ */
+uint32_t handle_open(handle_table_t *t, node_t *node) {
+    handle_entry_t *entry = node->handle;
+    if (entry != NULL) {
+        /* Already open */
+        return HANDLE_MAKE(entry->slot, entry->generation);
+    }
+    if (t->free_head != HANDLE_NO_SLOT) {
+        /* Reuse a free slot */
+        entry = t->body[t->free_head];
+        t->free_head = entry->next_free;
+    } else {
+        if (t->size == HANDLE_MAX_SLOTS) return HANDLE_NONE;
+        if (t->size == t->capacity) {
+            t->capacity = t->capacity > HANDLE_MAX_SLOTS / 2
+                          ? (uint16_t) HANDLE_MAX_SLOTS
+                          : t->capacity * (uint16_t) 2;
+            t->body = realloc_or_die(t->body,
+                                     t->capacity * sizeof(handle_entry_t *));
+        }
+        entry = t->body[t->size] = malloc_or_die(sizeof(handle_entry_t));
+        entry->table = t;
+        entry->slot = t->size++;
+        entry->generation = 0;
+    }
+    entry->node = node;
+    node->handle = entry;
+    for (node = node->parent; node != NULL; node = node->parent) {
+        node->stats.handles++;
+    }
+    return HANDLE_MAKE(entry->slot, entry->generation);
+}
+
+/**
+ * Return the node a handle refers to, or NULL if it was closed or the
+ * node was deleted
+ */
+node_t *handle_get(handle_table_t *t, uint32_t handle) {
+    handle_entry_t *entry = handle_lookup(t, handle);
+    return entry != NULL ? entry->node : NULL;
+}
+
+/**
+ * Release a handle
+ * Return true if succeeded, false if the handle was not valid
+ */
+bool handle_close(handle_table_t *t, uint32_t handle) {
+    handle_entry_t *entry = handle_lookup(t, handle);
+    if (entry == NULL) return false;
+    entry->node->handle = NULL;
+    for (node_t *node = entry->node->parent; node; node = node->parent) {
+        node->stats.handles--;
+    }
+    handle_invalidate(entry);
+    return true;
+}
+
+/**
+ * Free the slot of a node which is going away: the generation bump makes
+ * every outstanding copy of the handle stale
+ */
+void handle_invalidate(handle_entry_t *entry) {
+    handle_table_t *t = entry->table;
+    entry->node = NULL;
+    entry->generation++;
+    entry->next_free = t->free_head;
+    t->free_head = entry->slot;
+}
+
+/**
+ * Destroy the table, detaching every node still referenced
+ */
+void handle_table_destroy(handle_table_t *t) {
+    for (uint16_t i = 0; i < t->size; i++) {
+        if (t->body[i]->node != NULL)
+            t->body[i]->node->handle = NULL;
+        my_free(t->body[i]);
+    }
+    my_free(t->body);
+    my_free(t);
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright 2017 Francesco Circhetta
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef API_HANDLE_H
+#define API_HANDLE_H
+
+/****************************************************************************
+ * Included Files
+ ****************************************************************************/
+#include <stdint.h>
+#include <stdbool.h>
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+#define HANDLE_NONE UINT32_MAX
+
+/****************************************************************************
+* Public Types
+****************************************************************************/
+struct _node;
+struct _handle_table;
+
+/* Handle table slot */
+typedef struct _handle_entry {
+    struct _node        *node;          /* NULL if the slot is free */
+    struct _handle_table *table;
+    uint16_t            slot;
+    uint16_t            generation;     /* Bumped every time the slot is freed */
+    uint16_t            next_free;
+} handle_entry_t;
+
+/* Handle table */
+typedef struct _handle_table {
+    uint16_t            size;
+    uint16_t            capacity;
+    uint16_t            free_head;
+    handle_entry_t      **body;
+} handle_table_t;
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+handle_table_t *handle_table_create(void);
+uint32_t handle_open(handle_table_t *, struct _node *);
+struct _node *handle_get(handle_table_t *, uint32_t);
+bool handle_close(handle_table_t *, uint32_t);
+void handle_invalidate(handle_entry_t *);
+void handle_table_destroy(handle_table_t *);
+
+#endif //API_HANDLE_H
@@ -27,6 +27,25 @@
  ****************************************************************************/
 #define HT_INITIAL_CAPACITY 32
 
+#ifdef HASHTABLE_STATS
+#define HT_STAT(stmt) do { stmt; } while (0)
+#else
+#define HT_STAT(stmt) do { } while (0)
+#endif
+
+/****************************************************************************
+ * Private Data
+ ****************************************************************************/
+/* Free bodies of initial capacity, shared by every table in the process
+ * and linked through their first value */
+static hashtable_entry_t *ht_body_pool = NULL;
+
+#ifdef HASHTABLE_STATS
+static hashtable_stats_t ht_stats;
+/* Probe length of the last hashtable_find_slot */
+static size_t ht_probes;
+#endif
+
 /****************************************************************************
  * Private Functions
  ****************************************************************************/
@@ -36,6 +55,7 @@
  */
 uint64_t hashtable_hash(const char *key) {
     size_t len = strlen(key);
+    COST(hashes, 1);
     const uint64_t m = 0xc6a4a7935bd1e995ULL;
     const int r = 47;
     uint64_t h = 1023724138 ^ (len * m);
@@ -74,18 +94,76 @@ uint64_t hashtable_hash(const char *key) {
  */
 size_t hashtable_find_slot(hashtable_t *table, char *key) {
     size_t idx = hashtable_hash(key) % table->capacity;
+    HT_STAT(ht_probes = 0);
+    COST(probes, 1);
     while (table->body[idx].key != NULL
-           && strcmp(table->body[idx].key, key) != 0) {
+           && (COST(compares, 1), strcmp(table->body[idx].key, key) != 0)) {
         idx = (idx + 1) % table->capacity;
+        HT_STAT(ht_probes++);
+        COST(probes, 1);
     }
     return idx;
 }
 
+#ifdef HASHTABLE_STATS
+/**
+ * Count the probe length of the last hashtable_find_slot.
+ */
+static inline void hashtable_count_probes(hashtable_probes_t *p) {
+    unsigned int bucket = 0;
+    for (size_t n = ht_probes; n > 0 && bucket < HT_PROBE_BUCKETS - 1; n >>= 1) {
+        bucket++;
+    }
+    p->count++;
+    p->probes += ht_probes;
+    p->buckets[bucket]++;
+}
+
+/**
+ * Return the load bucket of a table of the given size and capacity.
+ */
+static inline unsigned int hashtable_load_bucket(uint16_t size,
+                                                 uint16_t capacity) {
+    unsigned int bucket = (unsigned int) size * HT_LOAD_BUCKETS / capacity;
+    return bucket < HT_LOAD_BUCKETS ? bucket : HT_LOAD_BUCKETS - 1;
+}
+
+/**
+ * Move a table from the load bucket of old_size entries to the one of
+ * its current size.
+ */
+static inline void hashtable_count_load(hashtable_t *t, uint16_t old_size,
+                                        uint16_t old_capacity) {
+    ht_stats.load[hashtable_load_bucket(old_size, old_capacity)]--;
+    ht_stats.load[hashtable_load_bucket(t->size, t->capacity)]++;
+}
+#endif
+
 /**
  * Allocate a new memory block with the given capacity.
  */
 static inline hashtable_entry_t *hashtable_body_allocate(unsigned int capacity) {
-    return (hashtable_entry_t *) calloc_or_die(capacity, sizeof(hashtable_entry_t));
+    if (capacity == HT_INITIAL_CAPACITY && ht_body_pool != NULL) {
+        hashtable_entry_t *body = ht_body_pool;
+        ht_body_pool = body[0].value;
+        memset(body, 0, capacity * sizeof(hashtable_entry_t));
+        return body;
+    }
+    return (hashtable_entry_t *) ALLOC_TAG(AllocTable,
+        calloc_or_die(capacity, sizeof(hashtable_entry_t)));
+}
+
+/**
+ * Release a memory block, keeping the ones of initial capacity for reuse.
+ */
+static inline void hashtable_body_release(hashtable_entry_t *body,
+                                          unsigned int capacity) {
+    if (capacity == HT_INITIAL_CAPACITY) {
+        body[0].value = ht_body_pool;
+        ht_body_pool = body;
+    } else {
+        my_free(body);
+    }
 }
 
 /****************************************************************************
@@ -96,10 +174,11 @@ static inline hashtable_entry_t *hashtable_body_allocate(unsigned int capacity)
  * Create a new, empty hashtable
  */
 hashtable_t *hashtable_create(void) {
-    hashtable_t *new_ht = malloc_or_die(sizeof(hashtable_t));
+    hashtable_t *new_ht = ALLOC_TAG(AllocTable, malloc_or_die(sizeof(hashtable_t)));
     new_ht->size = 0;
     new_ht->capacity = HT_INITIAL_CAPACITY;
     new_ht->body = hashtable_body_allocate(new_ht->capacity);
+    HT_STAT(ht_stats.tables++; ht_stats.load[0]++);
     return new_ht;
 }
 
@@ -108,6 +187,7 @@ hashtable_t *hashtable_create(void) {
  */
 void *hashtable_get(hashtable_t *table, char *key) {
     size_t idx = hashtable_find_slot(table, key);
+    HT_STAT(hashtable_count_probes(&ht_stats.lookup));
     return table->body[idx].key == NULL ? NULL : table->body[idx].value;
 }
 
@@ -116,6 +196,7 @@ void *hashtable_get(hashtable_t *table, char *key) {
  */
 bool hashtable_set(hashtable_t *t, char *key, void *value) {
     size_t index = hashtable_find_slot(t, key);
+    HT_STAT(hashtable_count_probes(&ht_stats.insert));
     if (t->body[index].key != NULL) {
         /* Entry exists; fail. */
         return false;
@@ -129,6 +210,7 @@ bool hashtable_set(hashtable_t *t, char *key, void *value) {
         t->size = t->size + (uint16_t)1;
         t->body[index].key = key;
         t->body[index].value = value;
+        HT_STAT(hashtable_count_load(t, t->size - (uint16_t)1, t->capacity));
         return true;
     }
 }
@@ -140,15 +222,24 @@ bool hashtable_set(hashtable_t *t, char *key, void *value) {
 void hashtable_resize(hashtable_t *t, uint16_t capacity) {
     uint16_t old_capacity = t->capacity;
     hashtable_entry_t *old_body = t->body;
+#ifdef HASHTABLE_STATS
+    uint16_t old_size = t->size;
+    uint64_t start = clock_ns();
+#endif
     t->body = hashtable_body_allocate(capacity);
     t->size = 0;
     t->capacity = capacity;
     for (unsigned int i = 0; i < old_capacity; i++) {
         if (old_body[i].key != NULL) {
-            hashtable_set(t, old_body[i].key, old_body[i].value);
+            /* Keys are unique: no need to go through hashtable_set */
+            size_t index = hashtable_find_slot(t, old_body[i].key);
+            t->body[index] = old_body[i];
+            t->size++;
         }
     }
-    free(old_body);
+    hashtable_body_release(old_body, old_capacity);
+    HT_STAT(hashtable_count_load(t, old_size, old_capacity));
+    HT_STAT(ht_stats.resizes++; ht_stats.resize_ns += clock_ns() - start);
 }
 
 /**
@@ -160,18 +251,21 @@ void hashtable_remove(hashtable_t *t, char *key) {
     if (t->body[idx].key != NULL) {
         size_t next = (idx + 1) % t->capacity;
         while (t->body[next].key != NULL) {
+            COST(probes, 1);
             size_t next_base = hashtable_hash(t->body[next].key) % t->capacity;
             if ((next > idx && (next_base <= idx || next_base > next))
                 || (next < idx && (next_base <= idx && next_base > next))) {
                 t->body[idx].key = t->body[next].key;
                 t->body[idx].value = t->body[next].value;
                 idx = next;
+                HT_STAT(ht_stats.shifts++);
             }
             next = (next + 1) % t->capacity;
         }
         t->body[idx].key = NULL;
         t->body[idx].value = NULL;
         t->size--;
+        HT_STAT(hashtable_count_load(t, t->size + (uint16_t)1, t->capacity));
     }
 }
 
@@ -197,8 +291,10 @@ void *hashtable_iterate(hashtable_t *table, size_t *state) {
  * Destroy the table and deallocate it from memory. This does not deallocate the contained items.
  */
 void hashtable_destroy(hashtable_t *t) {
-    free(t->body);
-    free(t);
+    HT_STAT(ht_stats.tables--;
+            ht_stats.load[hashtable_load_bucket(t->size, t->capacity)]--);
+    hashtable_body_release(t->body, t->capacity);
+    my_free(t);
 }
 
 /**
@@ -207,3 +303,12 @@ void hashtable_destroy(hashtable_t *t) {
 uint16_t hashtable_get_size(hashtable_t *table) {
     return table->size;
 }
+
+#ifdef HASHTABLE_STATS
+/**
+ * Return the counters of every table in the process
+ */
+const hashtable_stats_t *hashtable_get_stats(void) {
+    return &ht_stats;
+}
+#endif
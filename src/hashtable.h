@@ -23,6 +23,16 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+#ifdef HASHTABLE_STATS
+/* Probe lengths are counted in power of two buckets: 0, 1, 2-3, 4-7... */
+#define HT_PROBE_BUCKETS 17
+/* Load factors are counted in tenths */
+#define HT_LOAD_BUCKETS 10
+#endif
+
 /****************************************************************************
 * Public Types
 ****************************************************************************/
@@ -39,10 +49,31 @@ typedef struct _hashtable {
     hashtable_entry_t   *body;
 } hashtable_t;
 
+#ifdef HASHTABLE_STATS
+/* Probe lengths of one kind of operation */
+typedef struct _hashtable_probes {
+    uint64_t            count;
+    uint64_t            probes;         /* Sum of the probe lengths */
+    uint64_t            buckets[HT_PROBE_BUCKETS];
+} hashtable_probes_t;
+
+/* Counters shared by every table in the process */
+typedef struct _hashtable_stats {
+    hashtable_probes_t  lookup;
+    hashtable_probes_t  insert;
+    uint64_t            resizes;
+    uint64_t            resize_ns;      /* Time spent in hashtable_resize */
+    uint64_t            shifts;         /* Entries moved back by remove */
+    uint64_t            tables;         /* Live tables */
+    uint64_t            load[HT_LOAD_BUCKETS];  /* Live tables per load */
+} hashtable_stats_t;
+#endif
+
 /****************************************************************************
  * Public Functions
  ****************************************************************************/
 
+uint64_t hashtable_hash(const char *);
 uint16_t hashtable_get_size(hashtable_t *);
 hashtable_t *hashtable_create(void);
 void *hashtable_get(hashtable_t *, char *);
@@ -51,5 +82,8 @@ void hashtable_resize(hashtable_t *, uint16_t);
 void hashtable_remove(hashtable_t *, char *);
 void *hashtable_iterate(hashtable_t *, size_t *);
 void hashtable_destroy(hashtable_t *);
+#ifdef HASHTABLE_STATS
+const hashtable_stats_t *hashtable_get_stats(void);
+#endif
 
 #endif //API_HASHTABLE_H
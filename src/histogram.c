@@ -0,0 +1,94 @@
+/*
+ * Copyright 2017 Francesco Circhetta
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/****************************************************************************
+ * Included Files
+ ****************************************************************************/
+#include "histogram.h"
+
+/****************************************************************************
+ * Private Functions
+ ****************************************************************************/
+/**
+ * Return the index of the most significant bit set, value must not be 0
+ */
+static inline unsigned hist_msb(uint64_t value) {
+#ifdef __GNUC__
+    return 63u - (unsigned) __builtin_clzll(value);
+#else
+    unsigned msb = 0;
+    while (value >>= 1) msb++;
+    return msb;
+#endif
+}
+
+/**
+ * Return the bucket of a value
+ */
+static inline unsigned hist_index(uint64_t value) {
+    if (value < 2 * HIST_SUB) return (unsigned) value;
+    unsigned msb = hist_msb(value);
+    return (msb - HIST_SUB_BITS + 1) * HIST_SUB
+           + (unsigned) ((value >> (msb - HIST_SUB_BITS)) & (HIST_SUB - 1));
+}
+
+/**
+ * Return the highest value falling in a bucket
+ */
+static uint64_t hist_upper(unsigned index) {
+    if (index < 2 * HIST_SUB) return index;
+    unsigned shift = index / HIST_SUB - 1;
+    uint64_t lower = (uint64_t) (HIST_SUB + index % HIST_SUB) << shift;
+    return lower + ((uint64_t) 1 << shift) - 1;
+}
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+/**
+ * Count a value, in constant time
+ */
+void hist_record(histogram_t *h, uint64_t value) {
+    if (value >= (uint64_t) 1 << HIST_MAX_BITS) {
+        value = ((uint64_t) 1 << HIST_MAX_BITS) - 1;
+    }
+    h->buckets[hist_index(value)]++;
+    h->count++;
+    h->sum += value;
+    if (value > h->max) {
+        h->max = value;
+    }
+}
+
+/**
+ * Return the value below which the given fraction of the values fall,
+ * rounded up to the end of its bucket (but never above the maximum)
+ */
+uint64_t hist_percentile(histogram_t *h, double fraction) {
+    uint64_t rank = (uint64_t) (fraction * (double) h->count + 0.5);
+    uint64_t seen = 0;
+    if (rank == 0) rank = 1;
+    for (unsigned i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= rank) {
+            uint64_t upper = hist_upper(i);
+            return upper < h->max ? upper : h->max;
+        }
+    }
+    return h->max;
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright 2017 Francesco Circhetta
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef API_HISTOGRAM_H
+#define API_HISTOGRAM_H
+
+/****************************************************************************
+ * Included Files
+ ****************************************************************************/
+#include <stdint.h>
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+#define HIST_SUB_BITS 4 /* 16 buckets per power of two: 6.25% error */
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_MAX_BITS 40 /* Larger values are clamped */
+#define HIST_BUCKETS ((HIST_MAX_BITS - HIST_SUB_BITS + 1) * HIST_SUB)
+
+/****************************************************************************
+* Public Types
+****************************************************************************/
+/* Log-linear histogram: values below 2 * HIST_SUB have a bucket each, then
+ * every power of two is split into HIST_SUB buckets */
+typedef struct _histogram {
+    uint64_t            count;
+    uint64_t            sum;
+    uint64_t            max;
+    uint64_t            buckets[HIST_BUCKETS];
+} histogram_t;
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+void hist_record(histogram_t *, uint64_t);
+uint64_t hist_percentile(histogram_t *, double);
+
+#endif //API_HISTOGRAM_H
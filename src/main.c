@@ -27,9 +27,16 @@
  ****************************************************************************/
 #include <string.h>
 #include <stdio.h>
+#include <stdarg.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include "simplefs.h"
+#include "txn.h"
+#include "watch.h"
+#include "replica.h"
+#include "cache.h"
+#include "histogram.h"
+#include "trace.h"
 
 /****************************************************************************
  * Pre-processor Definitions
@@ -39,17 +46,183 @@
 #define RES_READ(x) "contenuto %s\n", (x)
 #define RES_WRITE(x) "ok %d\n", (x)
 #define RES_FIND(x) "ok %s\n", (x)
+#define RES_LS(x) "ok %s\n", (x)
+#define RES_LS_NEXT(x) "next %s\n", (x)
+#define RES_LS_END "end\n"
+#define RES_OPEN(x) "ok %lu\n", (unsigned long) (x)
+#define RES_WATCH(x) "ok %lu\n", (unsigned long) (x)
+#define RES_REPLICA(role, x) "ok %s %lu\n", (role), (unsigned long) (x)
+#define RES_STAT(x) "ok %lu %lu %llu %u\n", (unsigned long) (x)->files, \
+        (unsigned long) (x)->dirs, (unsigned long long) (x)->bytes, \
+        (unsigned) (x)->height
+#define RES_STATS_PREFIX "ok "
+#define STATS_VALUE(key, x) "%s %llu\n", (key), (unsigned long long) (x)
+#define STATS_LATENCY(cmd, key, x) "latency.%s.%s %llu\n", (cmd), (key), \
+        (unsigned long long) (x)
+#define STATS_HASHTABLE(key, x) "hashtable.%s %llu\n", (key), \
+        (unsigned long long) (x)
+
+#define JOURNAL_CREATE(x) "create %s\n", (x)
+#define JOURNAL_CREATE_DIR(x) "create_dir %s\n", (x)
+#define JOURNAL_WRITE(x, y) "write %s \"%s\"\n", (x), (y)
+#define JOURNAL_EXIT "exit\n"
+#define JOURNAL_TENANT(x) "tenant %s ", (x)
+
+#define USAGE "Usage: %s [-C] [-S] [-T <ns>] [-L <log>] [-F <log> [-W <n>]]\n" \
+    "  -C        compact: replay the input silently, then print the\n" \
+    "            shortest journal that rebuilds the same tree\n" \
+    "  -S        print the statistics to stderr on exit\n" \
+    "  -T <ns>   time the phases of every command, and keep the commands\n" \
+    "            slower than ns nanoseconds for the slow command\n" \
+    "  -L <log>  leader: ship changes to the operation log (FIFO or file)\n" \
+    "  -F <log>  follower: apply changes from the operation log, reject\n" \
+    "            changes from the input\n" \
+    "  -W <n>    follower: apply at most n changes before each command,\n" \
+    "            the leader is slowed down once the backlog fills up\n"
+
+#define LS_CURSOR_START "/"
+#define HANDLE_PREFIX '@'
+#define DEFAULT_TENANT ""
+#define MAX_TENANTS 16384 /* Within the uint16_t hashtable capacity */
+#define MAX_TENANT_LENGTH 64
+#define RECLAIM_BUDGET 256 /* Deleted nodes freed after each command */
 
 #define TOK_SPACE " \n\r\t"
 #define TOK_PATH_CONTINUE "/\n\r\t"
 #define TOK_PATH_START " /\n\r\t"
 #define TOK_CONTENT "\"\n\r\t"
 
+/****************************************************************************
+ * Private Types
+ ****************************************************************************/
+/* Commands */
+enum {
+    CmdCreate,
+    CmdCreateDir,
+    CmdRead,
+    CmdWrite,
+    CmdDelete,
+    CmdDeleteR,
+    CmdFind,
+    CmdLs,
+    CmdStat,
+    CmdOpen,
+    CmdClose,
+    CmdBegin,
+    CmdCommit,
+    CmdAbort,
+    CmdWatch,
+    CmdUnwatch,
+    CmdChangedSince,
+    CmdDiff,
+    CmdReplica,
+    CmdStats,
+    CmdSlow,
+    CmdUnknown,
+    CmdCount,
+};
+
+/* Process-wide state, shared by the tenants */
+typedef struct _engine {
+    hashtable_t         *tenants;       /* Sessions by tenant id */
+    struct _session     *fallback;      /* Session of the default tenant */
+    repl_t              *leader;        /* Followers' log, NULL if none */
+    repl_t              *follower;      /* Leader's log, NULL if none */
+    size_t              weight;         /* Changes per command, 0 for all */
+    char                *leader_log;
+    uint32_t            seq;            /* Current command number */
+    FILE                *out;           /* Responses, NULL to discard */
+    histogram_t         *latency;       /* Nanoseconds, by command */
+    trace_t             *trace;         /* Phase timers, NULL if off */
+} engine_t;
+
+/* Per-tenant state: an independent filesystem */
+typedef struct _session {
+    char                *id;
+    engine_t            *engine;
+    node_t              *root;
+    handle_table_t      *handles;
+    txn_t               *txn;           /* Open transaction, NULL if none */
+    watch_table_t       *watches;
+    repl_t              *leader;        /* Own queue on the engine leader */
+    cache_t             *finds;         /* Recent find results */
+} session_t;
+
+/****************************************************************************
+ * Private Data
+ ****************************************************************************/
+static const char *command_names[] = {
+    [CmdCreate] = "create",
+    [CmdCreateDir] = "create_dir",
+    [CmdRead] = "read",
+    [CmdWrite] = "write",
+    [CmdDelete] = "delete",
+    [CmdDeleteR] = "delete_r",
+    [CmdFind] = "find",
+    [CmdLs] = "ls",
+    [CmdStat] = "stat",
+    [CmdOpen] = "open",
+    [CmdClose] = "close",
+    [CmdBegin] = "begin",
+    [CmdCommit] = "commit",
+    [CmdAbort] = "abort",
+    [CmdWatch] = "watch",
+    [CmdUnwatch] = "unwatch",
+    [CmdChangedSince] = "changed_since",
+    [CmdDiff] = "diff",
+    [CmdReplica] = "replica",
+    [CmdStats] = "stats",
+    [CmdSlow] = "slow",
+    [CmdUnknown] = "unknown",
+};
+
+#ifdef ALLOC_STATS
+static const char *alloc_names[] = {
+    [AllocOther] = "other",
+    [AllocNode] = "node",
+    [AllocName] = "name",
+    [AllocContent] = "content",
+    [AllocTable] = "table",
+    [AllocResults] = "results",
+    [AllocPath] = "path",
+};
+#endif
+
 /****************************************************************************
  * Private Functions
  ****************************************************************************/
+/**
+ * Print a response to the client
+ */
+void reply(session_t *s, const char *format, ...) {
+    trace_phase(s->engine->trace, PhaseOutput);
+    if (s->engine->out != NULL) {
+        va_list args;
+        va_start(args, format);
+        vfprintf(s->engine->out, format, args);
+        va_end(args);
+    }
+}
+
+/**
+ * Parse a handle number, optionally preceded by HANDLE_PREFIX
+ * Return true if succeeded, false if token is not a handle
+ */
+bool parse_handle(char *token, uint32_t *handle) {
+    char *end;
+    if (token == NULL) return false;
+    if (*token == HANDLE_PREFIX) token++;
+    if (*token < '0' || *token > '9') return false;
+    unsigned long value = strtoul(token, &end, 10);
+    if (*end != '\0' || value >= HANDLE_NONE) return false;
+    *handle = (uint32_t) value;
+    return true;
+}
+
 /**
  * Find resource by its path string.
+ * A path whose first component is "@<handle>" is resolved relative to the
+ * node the handle was opened on, otherwise it starts from the root.
  * Function behaves differently based on new_name value:
  * if NULL function will enter path token by token and return the requested
  * resource, if a valid pointer is given it will store a pointer to a string
@@ -59,11 +232,20 @@
  *      node=root, path="/dir/file, new_name=valid pointer (dir exists, file doesn't)
  *          -> pointer=dir pointer new_name="file"
  */
-node_t *enter_path(node_t *node, char *path, char **new_name) {
-    node_t *tmp = NULL;
+node_t *resolve_path(session_t *s, char *path, char **new_name) {
+    node_t *node = s->root, *tmp = NULL;
+    uint32_t handle;
     char *cur_token = strtok(path, TOK_PATH_START);
     if (cur_token == NULL) return NULL; /* Empty path */
     char *next_token = strtok(NULL, TOK_PATH_CONTINUE);
+    if (*cur_token == HANDLE_PREFIX) {
+        /* Start from an open handle */
+        if (!parse_handle(cur_token, &handle)
+            || (node = handle_get(s->handles, handle)) == NULL)
+            return NULL;
+        cur_token = next_token;
+        next_token = cur_token ? strtok(NULL, TOK_PATH_CONTINUE) : NULL;
+    }
     /* Try to enter the path token by token */
     while (cur_token) {
         /* Enter only if current node is a dir */
@@ -83,52 +265,318 @@ node_t *enter_path(node_t *node, char *path, char **new_name) {
     return node;
 }
 
+/**
+ * Find resource by its path string, see resolve_path
+ */
+node_t *enter_path(session_t *s, char *path, char **new_name) {
+    trace_phase(s->engine->trace, PhaseResolve);
+    node_t *node = resolve_path(s, path, new_name);
+    if (node != NULL) {
+        trace_depth(s->engine->trace, node->depth);
+    }
+    trace_phase(s->engine->trace, PhaseExecute);
+    return node;
+}
+
+/**
+ * Like enter_path, but a path made of slashes only resolves to the root
+ * instead of failing. For commands that may target the root itself.
+ */
+node_t *enter_path_or_root(session_t *s, char *path) {
+    if (path != NULL && path[strspn(path, "/")] == '\0') {
+        trace_phase(s->engine->trace, PhaseExecute);
+        return s->root;
+    }
+    return enter_path(s, path, NULL);
+}
+
+/**
+ * Return the full paths of the given resources in lexicographic order.
+ * Takes ownership of the array.
+ */
+char **sort_paths(session_t *s, node_t **res, size_t nres) {
+    if (nres == 0) return NULL;
+    trace_phase(s->engine->trace, PhaseFormat);
+    /* Create an array of strings containig full paths */
+    char **paths = ALLOC_TAG(AllocResults, malloc_or_die(nres * sizeof(char *)));
+    for (size_t i = 0; i < nres; i++) {
+        paths[i] = fs_get_path(res[i], 0);
+    }
+    my_free(res);
+    /* Sort them with quicksort */
+    qsort(paths, nres, sizeof(char *), compare_str);
+    return paths;
+}
+
+/**
+ * Print the given paths, or a failure if there are none
+ */
+void reply_paths(session_t *s, char **paths, size_t nres) {
+    for (size_t i = 0; i < nres; i++) {
+        reply(s, RES_FIND(paths[i]));
+    }
+    if (nres == 0) {
+        reply(s, RES_FAIL);
+    }
+}
+
+/**
+ * Print the full paths of the given resources in lexicographic order, or
+ * a failure if there are none. Takes ownership of the array.
+ */
+void print_paths(session_t *s, node_t **res, size_t nres) {
+    char **paths = sort_paths(s, res, nres);
+    reply_paths(s, paths, nres);
+    for (size_t i = 0; i < nres; i++) {
+        my_free(paths[i]);
+    }
+    my_free(paths);
+}
+
+/**
+ * Queue a change for the followers, if this is a leader. Changes inside a
+ * subtree detached by the open transaction have no path to ship: they are
+ * dropped with the subtree on commit and undone on rollback.
+ */
+void ship(session_t *s, node_t *node, uint8_t op, char *data) {
+    if (s->leader != NULL && fs_is_attached(node)) {
+        char *path = fs_get_path(node, 0);
+        repl_log(s->leader, op, s->engine->seq, s->id, path, data);
+        my_free(path);
+    }
+}
+
+/**
+ * Create a new empty file/directory, and let the open transaction,
+ * the subscribers and the followers know
+ * Return the new resource, NULL if failed
+ */
+node_t *op_create(session_t *s, node_t *dir, char *name, uint8_t type) {
+    if (!fs_create(dir, name, type)) return NULL;
+    node_t *child = fs_find_in_dir(dir, name);
+    if (s->txn != NULL) {
+        txn_log_create(s->txn, child);
+    }
+    watch_notify(s->watches, child, EventCreate);
+    ship(s, child, type == Dir ? ReplCreateDir : ReplCreate, NULL);
+    return child;
+}
+
+/**
+ * Write the whole file content, and let the open transaction, the
+ * subscribers and the followers know
+ * Return true if succeeded, false if failed
+ */
+bool op_write(session_t *s, node_t *node, char *new_content) {
+    if (fs_get_type(node) != File) return false;
+    if (s->txn != NULL) {
+        /* Keep the old content around for rollback */
+        char *content = ALLOC_TAG(AllocContent, my_strdup(new_content));
+        txn_log_write(s->txn, node, fs_swap_file_content(node, content));
+    } else {
+        fs_set_file_content(node, new_content);
+    }
+    watch_notify(s->watches, node, EventWrite);
+    ship(s, node, ReplWrite, new_content);
+    return true;
+}
+
+/**
+ * Delete a resource (also recursively), and let the open transaction,
+ * the subscribers and the followers know
+ * Return true if succeeded, false if failed
+ */
+bool op_delete(session_t *s, node_t *node, bool recursive) {
+    /* Neither the root nor anything in a subtree detached by the open
+     * transaction */
+    if (node->parent == NULL || !fs_is_attached(node)) return false;
+    if (fs_get_type(node) == Dir && !recursive
+        && fs_get_stats(node)->files + fs_get_stats(node)->dirs > 0) {
+        /* Dir is not empty */
+        return false;
+    }
+    /* Notify while the path is still valid */
+    watch_notify(s->watches, node, EventDelete);
+    ship(s, node, recursive ? ReplDeleteR : ReplDelete, NULL);
+    if (s->txn == NULL) {
+        /* Unlink now, deallocate a slice at a time after each command */
+        fs_detach(node, recursive);
+        fs_free_later(node);
+    } else {
+        /* Keep the subtree around for rollback */
+        node_t *parent = node->parent;
+        fs_detach(node, recursive);
+        txn_log_delete(s->txn, node, parent);
+    }
+    return true;
+}
+
+/**
+ * Create a tenant with an empty filesystem
+ */
+session_t *session_create(engine_t *e, char *id) {
+    session_t *s = malloc_or_die(sizeof(session_t));
+    s->id = my_strdup(id);
+    s->engine = e;
+    s->root = fs_new_root();
+    s->handles = handle_table_create();
+    s->txn = NULL;
+    s->watches = watch_table_create();
+    s->leader = e->leader != NULL ? repl_share(e->leader) : NULL;
+    s->finds = cache_create();
+    hashtable_set(e->tenants, s->id, s);
+    return s;
+}
+
+/**
+ * Return the session of a tenant, created on first use
+ * Return NULL if the id is too long or there are too many tenants
+ */
+session_t *session_get(engine_t *e, char *id) {
+    session_t *s = hashtable_get(e->tenants, id);
+    if (s == NULL && strlen(id) <= MAX_TENANT_LENGTH
+        && hashtable_get_size(e->tenants) < MAX_TENANTS) {
+        s = session_create(e, id);
+    }
+    return s;
+}
+
+/**
+ * Roll back the transaction left open, if any
+ */
+void session_abort(session_t *s) {
+    if (s->txn != NULL) {
+        txn_abort(s->txn);
+        s->txn = NULL;
+        watch_discard(s->watches);
+        if (s->leader != NULL) {
+            repl_discard(s->leader);
+        }
+    }
+}
+
+/**
+ * Destroy a tenant and its filesystem
+ */
+void session_destroy(session_t *s) {
+    session_abort(s);
+    if (s->leader != NULL) {
+        repl_close(s->leader);
+    }
+    cache_destroy(s->finds);
+    watch_table_destroy(s->watches);
+    handle_table_destroy(s->handles);
+    fs_destroy_root(s->root);
+    my_free(s->id);
+    my_free(s);
+}
+
+/**
+ * Stop shipping changes, for all the tenants
+ */
+void engine_drop_leader(engine_t *e) {
+    size_t state = 0;
+    session_t *s;
+    while ((s = hashtable_iterate(e->tenants, &state)) != NULL) {
+        if (s->leader != NULL) {
+            repl_discard(s->leader);
+            repl_close(s->leader);
+            s->leader = NULL;
+        }
+    }
+    repl_close(e->leader);
+    e->leader = NULL;
+}
+
+/**
+ * Deliver the events and the changes of a session in a batch, once they
+ * can't be rolled back
+ */
+void deliver(session_t *s) {
+    if (s->txn != NULL) return;
+    trace_phase(s->engine->trace, PhaseOutput);
+    if (s->engine->out != NULL) {
+        watch_flush(s->watches, s->engine->out);
+    } else {
+        watch_discard(s->watches);
+    }
+    if (s->leader != NULL && !repl_flush(s->leader)) {
+        perror(s->engine->leader_log);
+        engine_drop_leader(s->engine);
+    }
+}
+
+/**
+ * Apply a change received from the leader to the tenant it belongs to
+ */
+void apply_record(void *ctx, repl_record_t *record) {
+    session_t *s = session_get(ctx, record->tenant);
+    char *name = NULL;
+    node_t *node;
+    if (s == NULL) return;
+    if (record->op == ReplCreate || record->op == ReplCreateDir) {
+        node = enter_path(s, record->path, &name);
+        if (name != NULL) {
+            op_create(s, node, name, record->op == ReplCreate ? File : Dir);
+        }
+    } else if ((node = enter_path(s, record->path, NULL)) != NULL) {
+        if (record->op == ReplWrite) {
+            op_write(s, node, record->data);
+        } else {
+            op_delete(s, node, record->op == ReplDeleteR);
+        }
+    }
+    deliver(s);
+}
+
 /**
  * create <path>
  * create_dir <path>
  * Create a new empty file/directory
  */
-void do_create(node_t *node, uint8_t type) {
+void do_create(session_t *s, uint8_t type) {
     char *name = NULL;
-    node = enter_path(node, NULL, &name);
-    if (name != NULL && fs_create(node, name, type)) {
-        printf(RES_OK);
+    node_t *node = enter_path(s, NULL, &name);
+    if (name != NULL && s->engine->follower == NULL
+        && op_create(s, node, name, type) != NULL) {
+        reply(s, RES_OK);
         return;
     }
-    printf(RES_FAIL);
+    reply(s, RES_FAIL);
 }
 
 /**
  * read <path>
  * Read file content
  */
-void do_read(node_t *node) {
+void do_read(session_t *s) {
     char *content;
-    node = enter_path(node, NULL, NULL);
+    node_t *node = enter_path(s, NULL, NULL);
     if (node != NULL && (content = fs_get_file_content(node))) {
-        printf(RES_READ(content));
+        reply(s, RES_READ(content));
         return;
     }
-    printf(RES_FAIL);
+    reply(s, RES_FAIL);
 }
 
 /**
  * write <path> "<content>"
  * Write the whole file content
  */
-void do_write(node_t *node) {
+void do_write(session_t *s) {
     char *path, *new_content;
     path = strtok(NULL, TOK_SPACE); /* First token is path */
     new_content = strtok(NULL, TOK_CONTENT); /* Second token is content */
 
-    node = enter_path(node, path, NULL);
+    node_t *node = enter_path(s, path, NULL);
     if (node != NULL
         && new_content != NULL
-        && fs_set_file_content(node, new_content)) {
-        printf(RES_WRITE((int) strlen(new_content)));
+        && s->engine->follower == NULL
+        && op_write(s, node, new_content)) {
+        reply(s, RES_WRITE((int) strlen(new_content)));
         return;
     }
-    printf(RES_FAIL);
+    reply(s, RES_FAIL);
 }
 
 /**
@@ -136,75 +584,675 @@ void do_write(node_t *node) {
  * delete_r <path>
  * Delete a resource (also recursively)
  */
-void do_delete(node_t *node, bool recursive) {
-    node = enter_path(node, NULL, NULL);
+void do_delete(session_t *s, bool recursive) {
+    node_t *node = enter_path(s, NULL, NULL);
+    if (node != NULL
+        && s->engine->follower == NULL
+        && op_delete(s, node, recursive)) {
+        reply(s, RES_OK);
+        return;
+    }
+    reply(s, RES_FAIL);
+}
+
+/**
+ * find <name> [@<handle>]
+ * Find a resource in the entire FS, or below an open directory.
+ * Repeated finds are served from the cache until the tree changes.
+ * Fails below a directory deleted by the open transaction, which has no
+ * path to print.
+ */
+void do_find(session_t *s) {
+    char *token = strtok(NULL, TOK_SPACE);
+    char *handle_str = strtok(NULL, TOK_SPACE);
+    node_t *start = s->root;
+    uint32_t handle;
+    char **paths;
+    size_t nres = 0;
+    if (token == NULL) {
+        reply(s, RES_FAIL);
+        return;
+    }
+    if (handle_str != NULL) {
+        start = parse_handle(handle_str, &handle)
+                ? handle_get(s->handles, handle) : NULL;
+        if (start == NULL || fs_get_type(start) != Dir
+            || !fs_is_attached(start)) {
+            reply(s, RES_FAIL);
+            return;
+        }
+    }
+    trace_phase(s->engine->trace, PhaseExecute);
+    /* Any change to the tree, the start included, reaches the root: the
+     * start is attached, and detaching it touches its parent */
+    if (!cache_get(s->finds, token, start, s->root->subtree_mtime,
+                   &paths, &nres)) {
+        /* Find resources with the given name */
+        node_t **res = fs_find_r(start, token, &nres, NULL);
+        paths = sort_paths(s, res, nres);
+        cache_put(s->finds, token, start, s->engine->seq, paths, nres);
+    }
+    reply_paths(s, paths, nres);
+}
+
+/**
+ * ls <path> [cursor] [limit]
+ * List a directory in lexicographic order, at most limit entries at a time
+ * (0 or missing means no limit). Listing starts after the entry named by
+ * cursor, "/" means from the beginning. If a page is truncated, the cursor
+ * to resume from is printed last, otherwise "end" is, also for an empty
+ * page. Fails if path is not a directory or limit is not a number.
+ */
+void do_ls(session_t *s) {
+    char *path = strtok(NULL, TOK_SPACE);
+    char *cursor = strtok(NULL, TOK_SPACE);
+    char *limit_str = strtok(NULL, TOK_SPACE);
+    node_t *node = path != NULL ? enter_path_or_root(s, path) : NULL;
+    size_t limit = 0;
+    char *end;
+
+    if (cursor != NULL && strcmp(cursor, LS_CURSOR_START) == 0) {
+        cursor = NULL;
+    }
+    if (limit_str != NULL) {
+        /* Digits only: strtoul would take a sign and stop at garbage */
+        limit = strtoul(limit_str, &end, 10);
+        if (*limit_str < '0' || *limit_str > '9' || *end != '\0') {
+            reply(s, RES_FAIL);
+            return;
+        }
+    }
+
+    size_t num = 0;
+    node_t **list = node != NULL ? fs_list_dir(node, &num) : NULL;
+    if (list != NULL) {
+        size_t i = fs_list_seek(list, num, cursor);
+        size_t last = (limit > 0 && num - i > limit) ? i + limit : num;
+        for (; i < last; i++) {
+            reply(s, RES_LS(list[i]->name));
+        }
+        if (last < num) {
+            reply(s, RES_LS_NEXT(list[last - 1]->name));
+        } else {
+            reply(s, RES_LS_END);
+        }
+        return;
+    }
+    reply(s, RES_FAIL);
+}
+
+/**
+ * stat <path>
+ * Print files, directories, content bytes and height of a subtree
+ */
+void do_stat(session_t *s) {
+    char *path = strtok(NULL, TOK_SPACE);
+    node_t *node = path != NULL ? enter_path_or_root(s, path) : NULL;
     if (node != NULL) {
-        printf(fs_delete(node, recursive) == true ? RES_OK : RES_FAIL);
+        reply(s, RES_STAT(fs_get_stats(node)));
+        return;
+    }
+    reply(s, RES_FAIL);
+}
+
+/**
+ * open <path>
+ * Return a handle to a resource, usable as "@<handle>" at the start of a
+ * path until the resource is deleted
+ */
+void do_open(session_t *s) {
+    char *path = strtok(NULL, TOK_SPACE);
+    node_t *node = path != NULL ? enter_path_or_root(s, path) : NULL;
+    uint32_t handle;
+    if (node != NULL
+        && (handle = handle_open(s->handles, node)) != HANDLE_NONE) {
+        reply(s, RES_OPEN(handle));
         return;
     }
-    printf(RES_FAIL);
+    reply(s, RES_FAIL);
 }
 
 /**
- * find <name>
- * Find a resource in the entire FS
+ * close <handle>
+ * Release a handle
  */
-void do_find(node_t *root) {
+void do_close(session_t *s) {
+    uint32_t handle;
+    if (parse_handle(strtok(NULL, TOK_SPACE), &handle)
+        && handle_close(s->handles, handle)) {
+        reply(s, RES_OK);
+        return;
+    }
+    reply(s, RES_FAIL);
+}
+
+/**
+ * begin
+ * Start a transaction: the following changes are applied tentatively
+ */
+void do_begin(session_t *s) {
+    if (s->txn == NULL && s->engine->follower == NULL) {
+        s->txn = txn_begin();
+        reply(s, RES_OK);
+        return;
+    }
+    reply(s, RES_FAIL);
+}
+
+/**
+ * commit
+ * abort
+ * Make the changes of the open transaction permanent, or roll them back
+ */
+void do_end(session_t *s, bool commit) {
+    if (s->txn != NULL) {
+        if (commit) {
+            txn_commit(s->txn);
+        } else {
+            txn_abort(s->txn);
+            /* Nothing happened after all */
+            watch_discard(s->watches);
+            if (s->leader != NULL) {
+                repl_discard(s->leader);
+            }
+        }
+        s->txn = NULL;
+        reply(s, RES_OK);
+        return;
+    }
+    reply(s, RES_FAIL);
+}
+
+/**
+ * watch <path>
+ * Subscribe to create, write and delete events below a resource. Events
+ * are printed as "event <id> <type> <path>" after the response of the
+ * command that caused them, or after commit inside a transaction.
+ */
+void do_watch(session_t *s) {
+    char *path = strtok(NULL, TOK_SPACE);
+    node_t *node = path != NULL ? enter_path_or_root(s, path) : NULL;
+    uint32_t id;
+    if (node != NULL && (id = watch_add(s->watches, node)) != WATCH_NONE) {
+        reply(s, RES_WATCH(id));
+        return;
+    }
+    reply(s, RES_FAIL);
+}
+
+/**
+ * unwatch <id>
+ * Cancel a subscription
+ */
+void do_unwatch(session_t *s) {
     char *token = strtok(NULL, TOK_SPACE);
+    char *end;
+    if (token != NULL && *token >= '0' && *token <= '9') {
+        unsigned long id = strtoul(token, &end, 10);
+        if (*end == '\0' && id < WATCH_NONE
+            && watch_remove(s->watches, (uint32_t) id)) {
+            reply(s, RES_OK);
+            return;
+        }
+    }
+    reply(s, RES_FAIL);
+}
+
+/**
+ * changed_since <seq> [path]
+ * Find the resources changed by the commands after the seq-th one,
+ * in the entire FS or below path. Fails below a resource deleted by the
+ * open transaction, which has no path to print.
+ */
+void do_changed_since(session_t *s) {
+    char *seq_str = strtok(NULL, TOK_SPACE);
+    char *path = strtok(NULL, TOK_SPACE);
+    node_t *start = path != NULL ? enter_path_or_root(s, path) : s->root;
+    char *end;
+    size_t nres = 0;
+    if (start != NULL && fs_is_attached(start) && seq_str != NULL
+        && *seq_str >= '0' && *seq_str <= '9') {
+        unsigned long seq = strtoul(seq_str, &end, 10);
+        if (*end == '\0') {
+            trace_phase(s->engine->trace, PhaseExecute);
+            node_t **res = fs_changed_since(start, seq > UINT32_MAX
+                                                   ? UINT32_MAX
+                                                   : (uint32_t) seq,
+                                            &nres, NULL);
+            print_paths(s, res, nres);
+            return;
+        }
+    }
+    reply(s, RES_FAIL);
+}
+
+/**
+ * diff <path> <path>
+ * Print the relative paths where two subtrees differ, in lexicographic
+ * order ("/" if the resources themselves differ)
+ */
+void do_diff(session_t *s) {
+    char *path_a = strtok(NULL, TOK_SPACE);
+    char *path_b = strtok(NULL, TOK_SPACE);
+    node_t *a = path_a != NULL ? enter_path_or_root(s, path_a) : NULL;
+    node_t *b = path_b != NULL ? enter_path_or_root(s, path_b) : NULL;
     size_t nres = 0;
-    /* Find resources with the given name */
-    node_t **res = fs_find_r(root, token, &nres, NULL);
-    if(nres > 0) {
-        /* Create an array of strings containig full paths */
-        char **paths = malloc_or_die(nres * sizeof(char *));
-        for (size_t i = 0; i < nres; i++) {
-            paths[i] = fs_get_path(res[i], 0);
-        }
-        free(res);
-        /* Sort them with quicksort */
-        qsort(paths, nres, sizeof(char *), compare_str);
-        for(size_t i = 0; i < nres; i++) {
-            printf(RES_FIND(paths[i]));
-            free(paths[i]);
-        }
-        free(paths);
+    if (a != NULL && b != NULL) {
+        char **paths = fs_diff(a, b, &nres);
+        if (nres > 0) {
+            trace_phase(s->engine->trace, PhaseFormat);
+            /* Sort them with quicksort */
+            qsort(paths, nres, sizeof(char *), compare_str);
+            for (size_t i = 0; i < nres; i++) {
+                reply(s, RES_FIND(paths[i]));
+                my_free(paths[i]);
+            }
+            my_free(paths);
+            return;
+        }
+    }
+    reply(s, RES_FAIL);
+}
+
+/**
+ * replica
+ * Print the role of the process and the sequence number, on the leader, of
+ * the last change shipped (leader) or applied (follower). The difference
+ * between the two is the replication lag, in commands.
+ */
+void do_replica(session_t *s) {
+    engine_t *e = s->engine;
+    if (e->follower != NULL) {
+        reply(s, RES_REPLICA("follower", e->follower->seq));
+    } else if (e->leader != NULL) {
+        reply(s, RES_REPLICA("leader", e->leader->seq));
     } else {
-        printf(RES_FAIL);
+        reply(s, RES_FAIL);
+    }
+}
+
+#ifdef HASHTABLE_STATS
+/**
+ * Print the probe lengths of one kind of hashtable operation, as the
+ * number of operations and total probes, then the number of operations
+ * per probe length bucket, named after its lowest length.
+ * Return the number of lines.
+ */
+size_t print_probes(FILE *out, const char *prefix, const char *op,
+                    const hashtable_probes_t *p) {
+    size_t lines = 2;
+    fprintf(out, "%shashtable.%s.count %llu\n", prefix, op,
+            (unsigned long long) p->count);
+    fprintf(out, "%shashtable.%s.probes %llu\n", prefix, op,
+            (unsigned long long) p->probes);
+    for (unsigned int i = 0; i < HT_PROBE_BUCKETS; i++) {
+        if (p->buckets[i] == 0) continue;
+        fprintf(out, "%shashtable.%s.probes.%llu %llu\n", prefix, op,
+                i == 0 ? 0ULL : 1ULL << (i - 1),
+                (unsigned long long) p->buckets[i]);
+        lines++;
+    }
+    return lines;
+}
+#endif
+
+#ifdef ALLOC_STATS
+/**
+ * Print the memory breakdown as "alloc.<category>.<key> <value>" lines,
+ * each preceded by prefix: the blocks allocated or resized, the bytes
+ * requested, the bytes in use and their peak.
+ * Return the number of lines printed
+ */
+size_t print_allocs(FILE *out, const char *prefix) {
+    const alloc_stats_t *allocs = alloc_get_stats();
+    for (int i = 0; i < AllocCount; i++) {
+        const char *name = alloc_names[i];
+        fprintf(out, "%salloc.%s.count %llu\n", prefix, name,
+                (unsigned long long) allocs[i].count);
+        fprintf(out, "%salloc.%s.bytes %llu\n", prefix, name,
+                (unsigned long long) allocs[i].bytes);
+        fprintf(out, "%salloc.%s.live %llu\n", prefix, name,
+                (unsigned long long) allocs[i].live);
+        fprintf(out, "%salloc.%s.peak %llu\n", prefix, name,
+                (unsigned long long) allocs[i].peak);
+    }
+    return 4 * AllocCount;
+}
+#endif
+
+/**
+ * Print the statistics as "<key> <value>" lines, each preceded by prefix:
+ * the engine counters, the tree and find cache of the session, then the
+ * latencies. Every value is kept up to date as commands run, so the cost
+ * does not depend on the size of the trees.
+ * Return the number of lines printed
+ */
+size_t print_stats(session_t *s, FILE *out, const char *prefix) {
+    engine_t *e = s->engine;
+    node_stats_t *tree = fs_get_stats(s->root);
+    const struct {
+        const char *key;
+        uint64_t value;
+    } values[] = {
+        {"commands", e->seq},
+        {"tenants", hashtable_get_size(e->tenants)},
+        {"tree.files", tree->files},
+        {"tree.dirs", tree->dirs},
+        {"tree.bytes", tree->bytes},
+        {"tree.height", tree->height},
+        {"tree.handles", tree->handles},
+        {"find_cache.hits", s->finds->hits},
+        {"find_cache.misses", s->finds->misses},
+        {"cost.hashes", cost.hashes},
+        {"cost.probes", cost.probes},
+        {"cost.compares", cost.compares},
+        {"cost.visits", cost.visits},
+        {"cost.bytes", cost.bytes},
+        {"cost.allocs", cost.allocs},
+    };
+    size_t lines = sizeof(values) / sizeof(values[0]);
+    for (size_t i = 0; i < lines; i++) {
+        fprintf(out, "%s", prefix);
+        fprintf(out, STATS_VALUE(values[i].key, values[i].value));
+    }
+#ifdef ALLOC_STATS
+    lines += print_allocs(out, prefix);
+#endif
+    for (int cmd = 0; cmd < CmdCount; cmd++) {
+        histogram_t *h = &e->latency[cmd];
+        if (h->count == 0) continue;
+        const char *name = command_names[cmd];
+        fprintf(out, "%s", prefix);
+        fprintf(out, STATS_LATENCY(name, "count", h->count));
+        fprintf(out, "%s", prefix);
+        fprintf(out, STATS_LATENCY(name, "mean", h->sum / h->count));
+        fprintf(out, "%s", prefix);
+        fprintf(out, STATS_LATENCY(name, "p50", hist_percentile(h, 0.5)));
+        fprintf(out, "%s", prefix);
+        fprintf(out, STATS_LATENCY(name, "p99", hist_percentile(h, 0.99)));
+        fprintf(out, "%s", prefix);
+        fprintf(out, STATS_LATENCY(name, "p999", hist_percentile(h, 0.999)));
+        fprintf(out, "%s", prefix);
+        fprintf(out, STATS_LATENCY(name, "max", h->max));
+        lines += 6;
+    }
+#ifdef HASHTABLE_STATS
+    const hashtable_stats_t *ht = hashtable_get_stats();
+    lines += print_probes(out, prefix, "lookup", &ht->lookup);
+    lines += print_probes(out, prefix, "insert", &ht->insert);
+    fprintf(out, "%s", prefix);
+    fprintf(out, STATS_HASHTABLE("resizes", ht->resizes));
+    fprintf(out, "%s", prefix);
+    fprintf(out, STATS_HASHTABLE("resize_ns", ht->resize_ns));
+    fprintf(out, "%s", prefix);
+    fprintf(out, STATS_HASHTABLE("shifts", ht->shifts));
+    fprintf(out, "%s", prefix);
+    fprintf(out, STATS_HASHTABLE("tables", ht->tables));
+    lines += 4;
+    for (unsigned int i = 0; i < HT_LOAD_BUCKETS; i++) {
+        if (ht->load[i] == 0) continue;
+        fprintf(out, "%shashtable.load.%u %llu\n", prefix,
+                i * 100 / HT_LOAD_BUCKETS, (unsigned long long) ht->load[i]);
+        lines++;
+    }
+#endif
+    return lines;
+}
+
+/**
+ * stats
+ * Print the statistics of the process and of the tenant, as
+ * "ok <key> <value>" lines, see print_stats.
+ * Latencies are in nanoseconds, per command, from the moment its line has
+ * been read, parsing included, to the end of its response and of the
+ * deleted nodes reclaimed after it.
+ */
+void do_stats(session_t *s) {
+    trace_phase(s->engine->trace, PhaseOutput);
+    if (s->engine->out != NULL
+        && print_stats(s, s->engine->out, RES_STATS_PREFIX) == 0) {
+        reply(s, RES_FAIL);
+    }
+}
+
+/**
+ * slow
+ * Print the commands slower than the -T threshold since the last call,
+ * at most the latest TRACE_RING ones, as "ok slow <seq> <ns> <phase>=<ns>...
+ * depth=<depth> <command>" lines
+ */
+void do_slow(session_t *s) {
+    engine_t *e = s->engine;
+    trace_phase(e->trace, PhaseOutput);
+    if (e->trace == NULL || e->out == NULL
+        || trace_flush(e->trace, e->out, RES_STATS_PREFIX) == 0) {
+        reply(s, RES_FAIL);
+    }
+}
+
+/**
+ * Print the commands that rebuild the content of a directory: files are
+ * created and written once, with their final content, and directories
+ * are visited in lexicographic order. Every command is preceded by prefix.
+ * path holds the path of dir, of length len.
+ */
+void dump_journal(FILE *out, char *prefix, node_t *dir, char *path,
+                  size_t len) {
+    size_t num = 0;
+    node_t **list = fs_list_dir(dir, &num);
+    for (size_t i = 0; i < num; i++) {
+        node_t *child = list[i];
+        path[len] = '/';
+        strcpy(&path[len + 1], child->name);
+        fputs(prefix, out);
+        if (fs_get_type(child) == Dir) {
+            fprintf(out, JOURNAL_CREATE_DIR(path));
+            dump_journal(out, prefix, child, path,
+                         len + 1 + strlen(child->name));
+        } else {
+            fprintf(out, JOURNAL_CREATE(path));
+            if (*fs_get_file_content(child) != '\0') {
+                fputs(prefix, out);
+                fprintf(out, JOURNAL_WRITE(path, fs_get_file_content(child)));
+            }
+        }
+    }
+    path[len] = '\0';
+}
+
+/**
+ * Print the journal of every tenant: the default one first, the others
+ * in lexicographic order of id
+ */
+void dump_tenants(engine_t *e) {
+    char path[(MAX_NAMELENGHT + 1) * MAX_DEPTH + 1] = "";
+    char prefix[sizeof("tenant  ") + MAX_TENANT_LENGTH];
+    size_t num = hashtable_get_size(e->tenants), state = 0, i = 0;
+    char **ids = malloc_or_die(num * sizeof(char *));
+    session_t *s;
+    while ((s = hashtable_iterate(e->tenants, &state)) != NULL) {
+        ids[i++] = s->id;
+    }
+    /* DEFAULT_TENANT sorts first */
+    qsort(ids, num, sizeof(char *), compare_str);
+    for (i = 0; i < num; i++) {
+        s = hashtable_get(e->tenants, ids[i]);
+        if (s == e->fallback) {
+            prefix[0] = '\0';
+        } else {
+            snprintf(prefix, sizeof(prefix), JOURNAL_TENANT(s->id));
+        }
+        dump_journal(stdout, prefix, s->root, path, 0);
+    }
+    my_free(ids);
+}
+
+/**
+ * Run a command on a session
+ * Return the command run
+ */
+int dispatch(session_t *s, char *token) {
+    int cmd = 0;
+    while (cmd < CmdUnknown && strcmp(token, command_names[cmd]) != 0) {
+        cmd++;
+    }
+    switch (cmd) {
+        case CmdCreate: do_create(s, File); break;
+        case CmdCreateDir: do_create(s, Dir); break;
+        case CmdRead: do_read(s); break;
+        case CmdWrite: do_write(s); break;
+        case CmdDelete: do_delete(s, false); break;
+        case CmdDeleteR: do_delete(s, true); break;
+        case CmdFind: do_find(s); break;
+        case CmdLs: do_ls(s); break;
+        case CmdStat: do_stat(s); break;
+        case CmdOpen: do_open(s); break;
+        case CmdClose: do_close(s); break;
+        case CmdBegin: do_begin(s); break;
+        case CmdCommit: do_end(s, true); break;
+        case CmdAbort: do_end(s, false); break;
+        case CmdWatch: do_watch(s); break;
+        case CmdUnwatch: do_unwatch(s); break;
+        case CmdChangedSince: do_changed_since(s); break;
+        case CmdDiff: do_diff(s); break;
+        case CmdReplica: do_replica(s); break;
+        case CmdStats: do_stats(s); break;
+        case CmdSlow: do_slow(s); break;
+        default: break;
     }
+    return cmd;
 }
 
 /****************************************************************************
  * Public Functions
  ****************************************************************************/
-int main() {
-    /* Root node init */
-    node_t *root = fs_new_root();
+int main(int argc, char *argv[]) {
+    char *leader_log = NULL, *follower_log = NULL;
+    unsigned long weight = 0;
+    unsigned long long threshold = 0;
+    bool compact = false, stats = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-C") == 0) {
+            compact = true;
+        } else if (strcmp(argv[i], "-S") == 0) {
+            stats = true;
+        } else if (strcmp(argv[i], "-L") == 0 && i + 1 < argc) {
+            leader_log = argv[++i];
+        } else if (strcmp(argv[i], "-F") == 0 && i + 1 < argc) {
+            follower_log = argv[++i];
+        } else if (strcmp(argv[i], "-T") == 0 && i + 1 < argc) {
+            threshold = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-W") == 0 && i + 1 < argc) {
+            weight = strtoul(argv[++i], NULL, 10);
+        } else {
+            fprintf(stderr, USAGE, argv[0]);
+            return 1;
+        }
+    }
+    /* Engine init */
+    engine_t engine;
+    engine_t *e = &engine;
+    e->tenants = hashtable_create();
+    e->leader = e->follower = NULL;
+    e->weight = weight;
+    e->leader_log = leader_log;
+    e->seq = 0;
+    e->out = compact ? NULL : stdout;
+    e->latency = calloc_or_die(CmdCount, sizeof(histogram_t));
+    e->trace = threshold > 0 ? trace_create(threshold) : NULL;
+    /* Open the follower end first: opening a FIFO waits for the reader */
+    if (follower_log != NULL
+        && (e->follower = repl_open(follower_log, ReplFollower)) == NULL) {
+        perror(follower_log);
+        return 1;
+    }
+    if (leader_log != NULL
+        && (e->leader = repl_open(leader_log, ReplLeader)) == NULL) {
+        perror(leader_log);
+        return 1;
+    }
+    e->fallback = session_create(e, DEFAULT_TENANT);
     /* Command parser */
     char *line = NULL;
     size_t len = 0;
-    while (my_getline(&line, &len) >= 0) {
+    int nread;
+    while ((nread = my_getline(&line, &len)) >= 0) {
+        if (e->follower != NULL) {
+            /* Catch up with the leader before serving the command */
+            repl_poll(e->follower, apply_record, e, e->weight);
+        }
+        uint64_t start = clock_ns();
+        if (e->trace != NULL) {
+            trace_begin(e->trace, start);
+        }
         char *token = strtok(line, TOK_SPACE);
         if (token) {
-            if (strcmp(token, "create") == 0) {
-                do_create(root, File);
-            } else if (strcmp(token, "create_dir") == 0) {
-                do_create(root, Dir);
-            } else if (strcmp(token, "read") == 0) {
-                do_read(root);
-            } else if (strcmp(token, "write") == 0) {
-                do_write(root);
-            } else if (strcmp(token, "delete") == 0) {
-                do_delete(root, false);
-            } else if (strcmp(token, "delete_r") == 0) {
-                do_delete(root, true);
-            } else if (strcmp(token, "find") == 0) {
-                do_find(root);
+            session_t *s = e->fallback;
+            /* Changes are stamped with the command sequence number */
+            fs_set_clock(++e->seq);
+            if (strcmp(token, "tenant") == 0) {
+                /* tenant <id> <command>: run the command on another FS */
+                char *id = strtok(NULL, TOK_SPACE);
+                token = strtok(NULL, TOK_SPACE);
+                s = id != NULL ? session_get(e, id) : NULL;
+                if (s == NULL || token == NULL
+                    || strcmp(token, "exit") == 0) {
+                    reply(e->fallback, RES_FAIL);
+                    continue;
+                }
             } else if (strcmp(token, "exit") == 0) {
                 break;
             }
+            int cmd = dispatch(s, token);
+            deliver(s);
+            trace_phase(e->trace, PhaseExecute);
+            fs_reclaim(RECLAIM_BUDGET);
+            uint64_t end = clock_ns();
+            hist_record(&e->latency[cmd], end - start);
+            if (e->trace != NULL) {
+                trace_end(e->trace, end, e->seq, line, (size_t) nread);
+            }
         }
     }
-    free(line);
-    fs_destroy_root(root);
+    my_free(line);
+    /* A transaction left open is not committed */
+    size_t num = hashtable_get_size(e->tenants), state = 0, i = 0;
+    session_t **sessions = malloc_or_die(num * sizeof(session_t *));
+    session_t *s;
+    while ((s = hashtable_iterate(e->tenants, &state)) != NULL) {
+        session_abort(s);
+        sessions[i++] = s;
+    }
+    if (compact) {
+        dump_tenants(e);
+        printf(JOURNAL_EXIT);
+    }
+    if (stats) {
+        print_stats(e->fallback, stderr, "");
+    }
+#ifdef ALLOC_STATS
+    if (!stats) {
+        /* The memory breakdown is reported anyway */
+        print_allocs(stderr, "");
+    }
+#endif
+    if (e->trace != NULL) {
+        trace_flush(e->trace, stderr, "");
+        trace_destroy(e->trace);
+    }
+    /* Keys belong to the sessions: destroy the table first */
+    hashtable_destroy(e->tenants);
+    for (i = 0; i < num; i++) {
+        session_destroy(sessions[i]);
+    }
+    my_free(sessions);
+    fs_reclaim(SIZE_MAX);
+    my_free(e->latency);
+    if (e->leader != NULL) {
+        repl_close(e->leader);
+    }
+    if (e->follower != NULL) {
+        repl_close(e->follower);
+    }
     return 0;
 }
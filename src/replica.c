@@ -0,0 +1,390 @@
+/*
+ * Copyright 2017 Francesco Circhetta
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/****************************************************************************
+ * Included Files
+ ****************************************************************************/
+#define _POSIX_C_SOURCE 200809L
+#ifdef __linux__
+#define _DEFAULT_SOURCE /* syscall */
+#endif
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+#include "utils.h"
+#include "replica.h"
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+/* Record header: op (1), seq (4), tenant length (1), path length (2),
+ * data length (4). Lengths include the NUL terminators, integers are
+ * little endian. */
+#define REPL_HEADER_SIZE 12
+#define REPL_READ_CHUNK 65536
+#define REPL_BUFFER_LIMIT (16 * REPL_READ_CHUNK) /* Follower backlog */
+#define REPL_RING_WAIT_NS 10000000 /* Recheck a full ring every 10 ms */
+
+/* Ring indexes are shared between processes */
+#define REPL_LOAD(x) __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define REPL_STORE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+#define REPL_FENCE() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+/****************************************************************************
+ * Private Functions
+ ****************************************************************************/
+/**
+ * Make room for size more bytes in the buffer
+ */
+static void repl_reserve(repl_t *r, size_t size) {
+    if (r->len + size > r->capacity) {
+        while (r->len + size > r->capacity) {
+            r->capacity = r->capacity > 0 ? r->capacity * 2 : REPL_READ_CHUNK;
+        }
+        r->buffer = realloc_or_die(r->buffer, r->capacity);
+    }
+}
+
+/**
+ * Store an unsigned integer of the given size, little endian
+ */
+static void repl_put(char *dst, uint32_t value, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        dst[i] = (char) (value >> (8 * i));
+    }
+}
+
+/**
+ * Load an unsigned integer of the given size, little endian
+ */
+static uint32_t repl_get(const char *src, size_t size) {
+    uint32_t value = 0;
+    for (size_t i = 0; i < size; i++) {
+        value |= (uint32_t) (unsigned char) src[i] << (8 * i);
+    }
+    return value;
+}
+
+/**
+ * Map the ring backed by the given file, creating it if needed
+ * Return NULL on failure
+ */
+static repl_ring_t *repl_ring_map(const char *path) {
+    int fd = open(path, O_RDWR | O_CREAT, 0600);
+    if (fd < 0) return NULL;
+    void *ring = MAP_FAILED;
+    if (ftruncate(fd, sizeof(repl_ring_t)) == 0) {
+        ring = mmap(NULL, sizeof(repl_ring_t), PROT_READ | PROT_WRITE,
+                    MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    return ring != MAP_FAILED ? ring : NULL;
+}
+
+/**
+ * Leader: sleep until the follower moves the tail away from the given
+ * value, or for a while
+ */
+static void repl_ring_wait(repl_ring_t *ring, uint32_t tail) {
+    struct timespec timeout = {0, REPL_RING_WAIT_NS};
+    REPL_STORE(ring->waiting, 1);
+    REPL_FENCE();
+    if (REPL_LOAD(ring->tail) != tail) return;
+#ifdef __linux__
+    syscall(SYS_futex, &ring->tail, FUTEX_WAIT, tail, &timeout, NULL, 0);
+#else
+    nanosleep(&timeout, NULL);
+#endif
+}
+
+/**
+ * Follower: wake the leader up if it waits for room
+ */
+static void repl_ring_wake(repl_ring_t *ring) {
+    REPL_FENCE();
+    if (REPL_LOAD(ring->waiting)) {
+        REPL_STORE(ring->waiting, 0);
+#ifdef __linux__
+        syscall(SYS_futex, &ring->tail, FUTEX_WAKE, 1, NULL, NULL, 0);
+#endif
+    }
+}
+
+/**
+ * Leader: copy bytes to the ring, waiting for room when it is full
+ * Return false if the follower is gone
+ */
+static bool repl_ring_write(repl_ring_t *ring, const char *src, size_t len) {
+    uint32_t head = ring->head;
+    while (len > 0) {
+        if (REPL_LOAD(ring->closed)) {
+            errno = EPIPE;
+            return false;
+        }
+        uint32_t tail = REPL_LOAD(ring->tail);
+        size_t room = REPL_RING_SIZE - (head - tail);
+        if (room == 0) {
+            repl_ring_wait(ring, tail);
+            continue;
+        }
+        size_t n = len < room ? len : room;
+        size_t offset = head & (REPL_RING_SIZE - 1);
+        size_t first = n < REPL_RING_SIZE - offset ? n : REPL_RING_SIZE - offset;
+        memcpy(ring->data + offset, src, first);
+        memcpy(ring->data, src + first, n - first);
+        head += (uint32_t) n;
+        REPL_STORE(ring->head, head);
+        src += n;
+        len -= n;
+    }
+    return true;
+}
+
+/**
+ * Follower: copy at most max bytes from the ring, without waiting
+ * Return the number of bytes copied
+ */
+static size_t repl_ring_read(repl_ring_t *ring, char *dst, size_t max) {
+    uint32_t tail = ring->tail;
+    size_t n = REPL_LOAD(ring->head) - tail;
+    if (n == 0) return 0;
+    if (n > max) n = max;
+    size_t offset = tail & (REPL_RING_SIZE - 1);
+    size_t first = n < REPL_RING_SIZE - offset ? n : REPL_RING_SIZE - offset;
+    memcpy(dst, ring->data + offset, first);
+    memcpy(dst + first, ring->data, n - first);
+    REPL_STORE(ring->tail, tail + (uint32_t) n);
+    repl_ring_wake(ring);
+    return n;
+}
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+/**
+ * Open the leader or the follower end of an operation log stream: a FIFO,
+ * or a regular file that the follower keeps reading as it grows. A path
+ * starting with REPL_SHM_PREFIX names the file backing a shared memory
+ * ring instead (e.g. "shm:/dev/shm/oplog"), which the leader resets.
+ * Return NULL on failure.
+ */
+repl_t *repl_open(const char *path, uint8_t role) {
+    repl_t *r = malloc_or_die(sizeof(repl_t));
+    r->role = role;
+    r->owner = NULL;
+    r->out = NULL;
+    r->fd = -1;
+    r->ring = NULL;
+    r->buffer = NULL;
+    r->len = 0;
+    r->head = 0;
+    r->capacity = 0;
+    r->seq = 0;
+    r->queued = 0;
+    if (strncmp(path, REPL_SHM_PREFIX, strlen(REPL_SHM_PREFIX)) == 0) {
+        r->ring = repl_ring_map(path + strlen(REPL_SHM_PREFIX));
+        if (r->ring == NULL) {
+            my_free(r);
+            return NULL;
+        }
+        if (role == ReplLeader) {
+            /* Start from an empty ring */
+            REPL_STORE(r->ring->head, 0);
+            REPL_STORE(r->ring->tail, 0);
+            REPL_STORE(r->ring->closed, 0);
+        }
+        return r;
+    }
+    if (role == ReplLeader) {
+        /* A follower going away must not kill the leader */
+        signal(SIGPIPE, SIG_IGN);
+        r->out = fopen(path, "wb");
+    } else {
+        r->fd = open(path, O_RDONLY | O_NONBLOCK);
+    }
+    if (r->out == NULL && r->fd < 0) {
+        my_free(r);
+        return NULL;
+    }
+    return r;
+}
+
+/**
+ * Leader: return another endpoint writing to the same stream, with its
+ * own queue. Closing it leaves the stream open.
+ */
+repl_t *repl_share(repl_t *leader) {
+    repl_t *r = malloc_or_die(sizeof(repl_t));
+    *r = *leader;
+    r->owner = leader;
+    r->buffer = NULL;
+    r->len = 0;
+    r->head = 0;
+    r->capacity = 0;
+    return r;
+}
+
+/**
+ * Leader: queue a record, shipped by the next repl_flush
+ */
+void repl_log(repl_t *r, uint8_t op, uint32_t seq, const char *tenant,
+              const char *path, const char *data) {
+    size_t tenant_len = strlen(tenant) + 1;
+    size_t path_len = strlen(path) + 1;
+    size_t data_len = data != NULL ? strlen(data) + 1 : 1;
+    size_t size = REPL_HEADER_SIZE + tenant_len + path_len + data_len;
+    repl_reserve(r, size);
+    char *dst = r->buffer + r->len;
+    dst[0] = (char) op;
+    repl_put(dst + 1, seq, 4);
+    repl_put(dst + 5, (uint32_t) tenant_len, 1);
+    repl_put(dst + 6, (uint32_t) path_len, 2);
+    repl_put(dst + 8, (uint32_t) data_len, 4);
+    dst += REPL_HEADER_SIZE;
+    memcpy(dst, tenant, tenant_len);
+    memcpy(dst + tenant_len, path, path_len);
+    memcpy(dst + tenant_len + path_len, data != NULL ? data : "", data_len);
+    r->len += size;
+    r->queued = seq;
+}
+
+/**
+ * Leader: ship the queued records with a single write
+ * Return false if the follower is gone
+ */
+bool repl_flush(repl_t *r) {
+    if (r->len == 0) return true;
+    size_t len = r->len;
+    r->len = 0;
+    r->seq = r->queued;
+    if (r->owner != NULL && r->owner->seq < r->seq) {
+        r->owner->seq = r->seq;
+    }
+    if (r->ring != NULL) {
+        return repl_ring_write(r->ring, r->buffer, len);
+    }
+    return fwrite(r->buffer, 1, len, r->out) == len && fflush(r->out) == 0;
+}
+
+/**
+ * Leader: drop the queued records
+ */
+void repl_discard(repl_t *r) {
+    r->len = 0;
+}
+
+/**
+ * Return the size of the record starting at src, whose header is complete
+ */
+static size_t repl_record_size(const char *src) {
+    return REPL_HEADER_SIZE + repl_get(src + 5, 1) + repl_get(src + 6, 2)
+           + repl_get(src + 8, 4);
+}
+
+/**
+ * Follower: return how many bytes to keep buffered from pos: at least
+ * REPL_BUFFER_LIMIT, and always enough for the next record, whatever its
+ * size
+ */
+static size_t repl_buffer_limit(repl_t *r, size_t pos) {
+    if (r->len - pos < REPL_HEADER_SIZE) return REPL_BUFFER_LIMIT;
+    size_t size = repl_record_size(r->buffer + pos);
+    return size > REPL_BUFFER_LIMIT ? size : REPL_BUFFER_LIMIT;
+}
+
+/**
+ * Follower: read whatever is available without blocking, and apply at most
+ * max complete records (0 means no limit). Records left over wait for the
+ * next round; once REPL_BUFFER_LIMIT bytes are waiting, or the next record
+ * if it is larger, reading stops, so that a leader writing to a FIFO
+ * blocks until the follower catches up.
+ * Return the number of records applied.
+ */
+size_t repl_poll(repl_t *r, repl_apply_t apply, void *ctx, size_t max) {
+    size_t applied = 0;
+    size_t pos = r->head;
+    if (pos > 0 && pos >= r->len - pos) {
+        /* Drop the records applied, once they outweigh the rest */
+        memmove(r->buffer, r->buffer + pos, r->len - pos);
+        r->len -= pos;
+        pos = 0;
+    }
+    while (r->len - pos < repl_buffer_limit(r, pos)) {
+        repl_reserve(r, REPL_READ_CHUNK);
+        ssize_t n = r->ring != NULL
+                    ? (ssize_t) repl_ring_read(r->ring, r->buffer + r->len,
+                                               REPL_READ_CHUNK)
+                    : read(r->fd, r->buffer + r->len, REPL_READ_CHUNK);
+        if (n <= 0) break; /* Nothing more for now (EAGAIN or EOF) */
+        r->len += (size_t) n;
+    }
+    while (r->len - pos >= REPL_HEADER_SIZE && (max == 0 || applied < max)) {
+        char *src = r->buffer + pos;
+        size_t tenant_len = repl_get(src + 5, 1);
+        size_t path_len = repl_get(src + 6, 2);
+        size_t size = repl_record_size(src);
+        if (r->len - pos < size) break; /* Partial record */
+        repl_record_t record;
+        record.op = (uint8_t) src[0];
+        record.seq = repl_get(src + 1, 4);
+        record.tenant = src + REPL_HEADER_SIZE;
+        record.path = record.tenant + tenant_len;
+        record.data = record.path + path_len;
+        apply(ctx, &record);
+        r->seq = record.seq;
+        applied++;
+        pos += size;
+    }
+    /* Keep the rest for the next round */
+    r->head = pos;
+    return applied;
+}
+
+/**
+ * Close the stream and deallocate the endpoint
+ */
+void repl_close(repl_t *r) {
+    if (r->role == ReplLeader) {
+        repl_flush(r);
+    } else if (r->ring != NULL) {
+        /* Don't let the leader wait for room forever */
+        REPL_STORE(r->ring->closed, 1);
+        repl_ring_wake(r->ring);
+    }
+    /* Shared endpoints leave the stream to the owner */
+    if (r->owner == NULL) {
+        if (r->ring != NULL) {
+            munmap(r->ring, sizeof(repl_ring_t));
+        } else if (r->role == ReplLeader) {
+            fclose(r->out);
+        } else {
+            close(r->fd);
+        }
+    }
+    my_free(r->buffer);
+    my_free(r);
+}
@@ -0,0 +1,101 @@
+/*
+ * Copyright 2017 Francesco Circhetta
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef API_REPLICA_H
+#define API_REPLICA_H
+
+/****************************************************************************
+ * Included Files
+ ****************************************************************************/
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+#define REPL_SHM_PREFIX "shm:"
+#define REPL_RING_SIZE (1u << 20) /* Power of two */
+
+/****************************************************************************
+* Public Types
+****************************************************************************/
+/* Replicated operation */
+enum {
+    ReplCreate,
+    ReplCreateDir,
+    ReplWrite,
+    ReplDelete,
+    ReplDeleteR,
+};
+
+/* Replication role */
+enum {
+    ReplLeader,
+    ReplFollower,
+};
+
+/* Decoded operation log record, strings point into the receive buffer */
+typedef struct _repl_record {
+    uint8_t             op;
+    uint32_t            seq;            /* Leader command sequence number */
+    char                *tenant;        /* "" for the default tenant */
+    char                *path;
+    char                *data;          /* Content for ReplWrite, else "" */
+} repl_record_t;
+
+/* Byte ring shared by a leader and a follower on the same host */
+typedef struct _repl_ring {
+    uint32_t            head;           /* Bytes written, modulo 2^32 */
+    uint32_t            tail;           /* Bytes read, modulo 2^32 */
+    uint32_t            waiting;        /* Leader waits for room */
+    uint32_t            closed;         /* Follower is gone */
+    char                data[REPL_RING_SIZE];
+} repl_ring_t;
+
+/* Replication endpoint */
+typedef struct _repl {
+    uint8_t             role;
+    struct _repl        *owner;         /* Leader stream owner, if shared */
+    FILE                *out;           /* Leader stream */
+    int                 fd;             /* Follower descriptor */
+    repl_ring_t         *ring;          /* Shared memory, instead of both */
+    char                *buffer;        /* Unshipped/unparsed records */
+    size_t              len;
+    size_t              head;           /* First unapplied byte (follower) */
+    size_t              capacity;
+    uint32_t            seq;            /* Last shipped/applied record */
+    uint32_t            queued;         /* Last queued record (leader) */
+} repl_t;
+
+/* Called by repl_poll for every record received */
+typedef void (*repl_apply_t)(void *, repl_record_t *);
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+repl_t *repl_open(const char *, uint8_t);
+repl_t *repl_share(repl_t *);
+void repl_log(repl_t *, uint8_t, uint32_t, const char *, const char *,
+              const char *);
+bool repl_flush(repl_t *);
+void repl_discard(repl_t *);
+size_t repl_poll(repl_t *, repl_apply_t, void *, size_t);
+void repl_close(repl_t *);
+
+#endif //API_REPLICA_H
@@ -21,27 +21,291 @@
 
 #include "simplefs.h"
 
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+#define HASH_TAG_FILE 0x46494c45ULL
+#define HASH_TAG_DIR 0x44495200ULL
+#define FS_POOL_CHUNK 256
+
+/****************************************************************************
+ * Private Data
+ ****************************************************************************/
+/* Logical clock stamped on every change */
+static uint32_t fs_clock = 0;
+
+/* Free nodes, shared by every tree in the process and linked through
+ * their parent pointer */
+static node_t *fs_pool = NULL;
+
+/* Detached subtrees waiting to be freed, linked through their parent
+ * pointer */
+static node_t *fs_reclaim_list = NULL;
+
+/****************************************************************************
+ * Private Functions
+ ****************************************************************************/
+/**
+ * Take a node from the pool, carving a new chunk if it is empty.
+ * Chunks are never returned: freed nodes are recycled by any tree.
+ */
+static node_t *fs_node_alloc(void) {
+    if (fs_pool == NULL) {
+        /* Recycle the deleted nodes first */
+        fs_reclaim(FS_POOL_CHUNK);
+    }
+    if (fs_pool == NULL) {
+        node_t *chunk = ALLOC_TAG(AllocNode,
+                                  malloc_or_die(FS_POOL_CHUNK * sizeof(node_t)));
+        for (size_t i = 0; i < FS_POOL_CHUNK; i++) {
+            chunk[i].parent = fs_pool;
+            fs_pool = &chunk[i];
+        }
+    }
+    node_t *node = fs_pool;
+    fs_pool = node->parent;
+    return node;
+}
+
+/**
+ * Give a node back to the pool
+ */
+static void fs_node_release(node_t *node) {
+    node->parent = fs_pool;
+    fs_pool = node;
+}
+
+/**
+ * Deallocate a single node, its children aside
+ */
+static void fs_free_node(node_t *node) {
+    COST(visits, 1);
+    if (node->handle != NULL) {
+        handle_invalidate(node->handle);
+    }
+    /* Subscriptions stay registered, but silent */
+    for (watch_t *watch = node->watchers; watch; watch = watch->next) {
+        watch->node = NULL;
+    }
+    if (node->type == Dir) {
+        hashtable_destroy(node->payload.dirhash);
+        my_free(node->listing);
+    } else {
+        my_free(node->payload.content);
+    }
+    my_free(node->name);
+    fs_node_release(node);
+}
+
+/**
+ * Stamp a change on node with the current clock, and let its ancestors
+ * know that their subtree changed
+ */
+static void fs_touch(node_t *node) {
+    node->mtime = fs_clock;
+    for (node_t *cur = node; cur != NULL && cur->subtree_mtime != fs_clock;
+         cur = cur->parent) {
+        cur->subtree_mtime = fs_clock;
+    }
+    /* Ancestors of a stale hash are stale: stop at the first one */
+    for (; node != NULL && node->hash_valid; node = node->parent) {
+        node->hash_valid = false;
+    }
+}
+
+/**
+ * Scramble the bits of a 64 bit value (SplitMix64 finalizer)
+ */
+static inline uint64_t fs_hash_mix(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+/**
+ * Append a relative path to a growing array of strings
+ */
+static char **fs_diff_report(char **paths, size_t *num, char *path) {
+    *num = *num + 1;
+    paths = (paths == NULL) ? ALLOC_TAG(AllocResults, malloc_or_die(sizeof(char *)))
+                            : realloc_or_die(paths, (*num) * sizeof(char *));
+    paths[*num - 1] = ALLOC_TAG(AllocPath,
+                                my_strdup(*path != '\0' ? path : "/"));
+    return paths;
+}
+
+/**
+ * Collect the paths where two subtrees differ, relative to their roots.
+ * path holds the relative path of a and b, of length len.
+ */
+static char **fs_diff_r(node_t *a, node_t *b, char *path, size_t len,
+                        char **paths, size_t *num) {
+    if (fs_get_hash(a) == fs_get_hash(b)) return paths;
+    if (a->type != Dir || b->type != Dir) {
+        /* Different content, or a file replaced by a dir */
+        return fs_diff_report(paths, num, path);
+    }
+    size_t state = 0; // Iterator state
+    node_t *child = hashtable_iterate(a->payload.dirhash, &state);
+    while (child) {
+        COST(visits, 1);
+        node_t *other = hashtable_get(b->payload.dirhash, child->name);
+        path[len] = '/';
+        strcpy(&path[len + 1], child->name);
+        paths = other != NULL
+                ? fs_diff_r(child, other, path, len + 1 + strlen(child->name),
+                            paths, num)
+                : fs_diff_report(paths, num, path); /* Only in a */
+        child = hashtable_iterate(a->payload.dirhash, &state);
+    }
+    state = 0;
+    child = hashtable_iterate(b->payload.dirhash, &state);
+    while (child) {
+        if (hashtable_get(a->payload.dirhash, child->name) == NULL) {
+            /* Only in b */
+            path[len] = '/';
+            strcpy(&path[len + 1], child->name);
+            paths = fs_diff_report(paths, num, path);
+        }
+        child = hashtable_iterate(b->payload.dirhash, &state);
+    }
+    path[len] = '\0';
+    return paths;
+}
+
+/**
+ * Compare two nodes by name
+ * Used as compare function for qsort
+ */
+static int compare_node(const void *a, const void *b) {
+    COST(compares, 1);
+    return strcmp((*(node_t * const *)a)->name, (*(node_t * const *)b)->name);
+}
+
+/**
+ * Keep the sorted snapshot of a directory in sync after a child was added
+ * (the directory hashtable must already contain the child)
+ */
+static void fs_listing_insert(node_t *dir, node_t *child) {
+    size_t n = hashtable_get_size(dir->payload.dirhash);
+    dir->listing = realloc_or_die(dir->listing, n * sizeof(node_t *));
+    size_t pos = fs_list_seek(dir->listing, n - 1, child->name);
+    memmove(&dir->listing[pos + 1], &dir->listing[pos],
+            (n - 1 - pos) * sizeof(node_t *));
+    dir->listing[pos] = child;
+}
+
+/**
+ * Keep the sorted snapshot of a directory in sync before a child is removed
+ * (the directory hashtable must still contain the child)
+ */
+static void fs_listing_remove(node_t *dir, node_t *child) {
+    size_t n = hashtable_get_size(dir->payload.dirhash);
+    node_t **item = bsearch(&child, dir->listing, n, sizeof(node_t *),
+                            compare_node);
+    if (item != NULL) {
+        memmove(item, item + 1,
+                (size_t) (&dir->listing[n - 1] - item) * sizeof(node_t *));
+    }
+}
+
+/**
+ * Account for a subtree that was just linked under parent: every ancestor
+ * gets its counters incremented, so the walk costs O(depth)
+ */
+static void fs_stats_attach(node_t *parent, node_t *child) {
+    uint16_t height = child->stats.height + (uint16_t)1;
+    for (node_t *node = parent; node != NULL; node = node->parent) {
+        COST(visits, 1);
+        node->stats.files += child->stats.files + (child->type == File);
+        node->stats.dirs += child->stats.dirs + (child->type == Dir);
+        node->stats.bytes += child->stats.bytes;
+        node->stats.handles += child->stats.handles + (child->handle != NULL);
+        if (node->stats.height < height)
+            node->stats.height = height;
+        height++;
+    }
+}
+
+/**
+ * Account for a subtree that was just unlinked from parent.
+ * Counters are decremented along the parent chain; heights are recomputed
+ * from the children only while the removed subtree was the deepest one.
+ */
+static void fs_stats_detach(node_t *parent, node_t *child) {
+    uint16_t lost = child->stats.height + (uint16_t)1;
+    for (node_t *node = parent; node != NULL; node = node->parent) {
+        COST(visits, 1);
+        node->stats.files -= child->stats.files + (child->type == File);
+        node->stats.dirs -= child->stats.dirs + (child->type == Dir);
+        node->stats.bytes -= child->stats.bytes;
+        node->stats.handles -= child->stats.handles + (child->handle != NULL);
+    }
+    while (parent != NULL && parent->stats.height == lost) {
+        uint16_t height = 0;
+        size_t state = 0;
+        node_t *sibling = hashtable_iterate(parent->payload.dirhash, &state);
+        while (sibling) {
+            COST(visits, 1);
+            if (sibling->stats.height + 1 > height)
+                height = sibling->stats.height + (uint16_t)1;
+            sibling = hashtable_iterate(parent->payload.dirhash, &state);
+        }
+        if (height == parent->stats.height) break;
+        lost = parent->stats.height + (uint16_t)1;
+        parent->stats.height = height;
+        parent = parent->parent;
+    }
+}
+
 /****************************************************************************
  * Public Functions
  ****************************************************************************/
 /**
- * Create and return a new string with node full path
+ * Create and return a new string with node full path, followed by room
+ * for len more characters.
+ * The length is summed first, then the names are copied from the end:
+ * every name is copied once, so the cost is linear in the path length.
  */
 char *fs_get_path(node_t *node, size_t len) {
-    char *path;
-    /* Root? Alloc path array */
-    if (node->parent != NULL) {
-        path = fs_get_path(node->parent, len + strlen(node->name) + 1);
-        strcat(path, "/");
-        strcat(path, node->name);
-    } else {
-        path = calloc_or_die(len + 1, sizeof(char));
-        if (len == 0)
-            strcat(path, "/");
+    size_t size = 0;
+    node_t *cur;
+    for (cur = node; cur->parent != NULL; cur = cur->parent) {
+        COST(visits, 1);
+        size += strlen(cur->name) + 1;
+    }
+    COST(visits, 1); /* The root */
+    char *path = ALLOC_TAG(AllocPath, calloc_or_die(
+        (size > 0 ? size : 1) + len + 1, sizeof(char)));
+    if (size == 0) {
+        /* Root */
+        path[0] = '/';
+        return path;
+    }
+    for (cur = node; cur->parent != NULL; cur = cur->parent) {
+        size_t name_len = strlen(cur->name);
+        size -= name_len;
+        memcpy(&path[size], cur->name, name_len);
+        path[--size] = '/';
+        COST(bytes, name_len + 1);
     }
     return path;
 }
 
+/**
+ * Return true if the node can be reached from a root, false if it belongs
+ * to a subtree unlinked with fs_detach
+ */
+bool fs_is_attached(node_t *node) {
+    for (; node->parent != NULL; node = node->parent) {
+        COST(visits, 1);
+    }
+    return node->depth == 0;
+}
+
 /**
  * Get node type, Dir or File
  */
@@ -69,17 +333,38 @@ bool fs_set_file_content(node_t *node, char *new_content) {
         /* This isn't a file */
         return false;
     }
-    /* Free the old content */
-    free(node->payload.content);
-    /* Duplicate the new content */
-    node->payload.content = my_strdup(new_content);
+    /* Duplicate the new content and free the old one */
+    char *content = ALLOC_TAG(AllocContent, my_strdup(new_content));
+    my_free(fs_swap_file_content(node, content));
     return true;
 }
 
+/**
+ * Replace the content of a file with the given heap string, which the file
+ * takes ownership of. Return the old content, or NULL if node is not a file.
+ */
+char *fs_swap_file_content(node_t *node, char *new_content) {
+    if (fs_get_type(node) != File) {
+        /* This isn't a file */
+        return NULL;
+    }
+    char *old_content = node->payload.content;
+    uint64_t old_len = strlen(old_content);
+    uint64_t new_len = strlen(new_content);
+    node->payload.content = new_content;
+    fs_touch(node);
+    /* Update content size up to the root */
+    for (; node != NULL; node = node->parent) {
+        node->stats.bytes = node->stats.bytes - old_len + new_len;
+    }
+    return old_content;
+}
+
 /**
  * Get a node by name from a specific directory, return NULL if not found
  */
 node_t *fs_find_in_dir(node_t *parent, char *key) {
+    COST(visits, 1);
     /* Get node from dir hashtable */
     return hashtable_get(parent->payload.dirhash, key);
 }
@@ -94,23 +379,36 @@ bool fs_create(node_t *parent, char *key, uint8_t type) {
         || parent->depth >= MAX_DEPTH) /* Parent node is at max depth */
         return false;
     /* Create a new empty resource */
-    node_t *child = malloc_or_die(sizeof(node_t));
-    child->name = my_strdup(key);
+    node_t *child = fs_node_alloc();
+    child->name = ALLOC_TAG(AllocName, my_strdup(key));
     if (hashtable_set(parent->payload.dirhash, child->name, child)) {
         child->depth = parent->depth + (uint16_t)1;
         child->parent = parent;
         child->type = type;
+        child->listing = NULL;
+        child->handle = NULL;
+        child->watchers = NULL;
+        child->mtime = child->subtree_mtime = 0;
+        child->hash_valid = false;
+        memset(&child->stats, 0, sizeof(node_stats_t));
+        fs_stats_attach(parent, child);
+        fs_touch(child);
+        fs_touch(parent);
+        if (parent->listing != NULL) {
+            fs_listing_insert(parent, child);
+        }
         if (type == Dir) {
             // Empty DirHash
             child->payload.dirhash = hashtable_create();
         } else {
             // Empty content
-            child->payload.content = calloc_or_die(1, sizeof(char));
+            child->payload.content = ALLOC_TAG(AllocContent,
+                                               calloc_or_die(1, sizeof(char)));
         }
         return true;
     }
-    free(child->name);
-    free(child);
+    my_free(child->name);
+    fs_node_release(child);
     return false;
 }
 
@@ -118,52 +416,129 @@ bool fs_create(node_t *parent, char *key, uint8_t type) {
  * Delete a resource (also recursively)
  */
 bool fs_delete(node_t *node, bool recursive) {
-    /* If dir is not empty, delete every child */
-    if (node->type == Dir) {
-        if(hashtable_get_size(node->payload.dirhash) > 0) {
-            /* Recursion disabled? Dir is not empty! */
-            if (!recursive) return false;
-            /* Iterate through the table */
-            do {
-                size_t state = 0;
-                node_t *child = hashtable_iterate(node->payload.dirhash, &state);
-                while (child) {
-                    fs_delete(child, true);
-                    child = hashtable_iterate(node->payload.dirhash, &state);
-                }
-            } while (hashtable_get_size(node->payload.dirhash) > 0);
-        }
-        hashtable_destroy(node->payload.dirhash);
-    } else {
-        free(node->payload.content);
+    if (!fs_detach(node, recursive)) return false;
+    fs_free(node);
+    return true;
+}
+
+/**
+ * Unlink a resource (also recursively) from its directory, without
+ * deallocating it: the detached subtree can be linked back with fs_attach
+ * or released with fs_free.
+ * Return true if succeeded, false if failed
+ */
+bool fs_detach(node_t *node, bool recursive) {
+    /* Recursion disabled? Dir is not empty! */
+    if (node->type == Dir && !recursive
+        && hashtable_get_size(node->payload.dirhash) > 0)
+        return false;
+    node_t *parent = node->parent;
+    if (parent->listing != NULL) {
+        fs_listing_remove(parent, node);
+    }
+    hashtable_remove(parent->payload.dirhash, node->name);
+    fs_stats_detach(parent, node);
+    fs_touch(parent);
+    node->parent = NULL;
+    return true;
+}
+
+/**
+ * Link a subtree detached with fs_detach back into its former directory.
+ * Return true if succeeded, false if the name has been taken meanwhile.
+ */
+bool fs_attach(node_t *parent, node_t *node) {
+    if (!hashtable_set(parent->payload.dirhash, node->name, node))
+        return false;
+    node->parent = parent;
+    fs_stats_attach(parent, node);
+    fs_touch(parent);
+    if (parent->listing != NULL) {
+        fs_listing_insert(parent, node);
     }
-    hashtable_remove(node->parent->payload.dirhash, node->name);
-    free(node->name);
-    free(node);
     return true;
 }
 
+/**
+ * Deallocate a detached subtree, without any bookkeeping on the tree it
+ * belonged to
+ */
+void fs_free(node_t *node) {
+    if (node->type == Dir && node->stats.files + node->stats.dirs > 0) {
+        size_t state = 0;
+        node_t *child = hashtable_iterate(node->payload.dirhash, &state);
+        while (child) {
+            fs_free(child);
+            child = hashtable_iterate(node->payload.dirhash, &state);
+        }
+    }
+    fs_free_node(node);
+}
+
+/**
+ * Like fs_free, but deallocate the subtree a slice at a time, from
+ * fs_reclaim. Subtrees reachable from an open handle are freed at once,
+ * as their handles must go stale.
+ */
+void fs_free_later(node_t *node) {
+    if (node->handle != NULL || node->stats.handles > 0) {
+        fs_free(node);
+        return;
+    }
+    node->parent = fs_reclaim_list;
+    fs_reclaim_list = node;
+}
+
+/**
+ * Deallocate at most budget nodes of the subtrees passed to fs_free_later
+ * Return the number of nodes deallocated
+ */
+size_t fs_reclaim(size_t budget) {
+    size_t freed = 0;
+    while (fs_reclaim_list != NULL && freed < budget) {
+        node_t *node = fs_reclaim_list;
+        fs_reclaim_list = node->parent;
+        if (node->type == Dir && node->stats.files + node->stats.dirs > 0) {
+            /* Children wait for their turn */
+            size_t state = 0;
+            node_t *child = hashtable_iterate(node->payload.dirhash, &state);
+            while (child) {
+                child->parent = fs_reclaim_list;
+                fs_reclaim_list = child;
+                child = hashtable_iterate(node->payload.dirhash, &state);
+            }
+        }
+        fs_free_node(node);
+        freed++;
+    }
+    return freed;
+}
+
 /**
  * Create a new root directory
  */
 node_t *fs_new_root(void) {
     node_t *root;
-    root = malloc_or_die(sizeof(node_t));
-    root->name = calloc_or_die(1, sizeof(char));
+    root = fs_node_alloc();
+    root->name = ALLOC_TAG(AllocName, calloc_or_die(1, sizeof(char)));
     root->depth = 0;
     root->parent = NULL;
     root->type = Dir;
+    root->listing = NULL;
+    root->handle = NULL;
+    root->watchers = NULL;
+    root->mtime = root->subtree_mtime = fs_clock;
+    root->hash_valid = false;
+    memset(&root->stats, 0, sizeof(node_stats_t));
     root->payload.dirhash = hashtable_create();
     return root;
 }
 
 /**
- * Destroy the root directory
+ * Destroy the root directory and the whole tree below it
  */
 void fs_destroy_root(node_t *root) {
-    hashtable_destroy(root->payload.dirhash);
-    free(root->name);
-    free(root);
+    fs_free(root);
 }
 
 /**
@@ -173,18 +548,148 @@ node_t **fs_find_r(node_t *node, char *name, size_t *num, node_t **array) {
     size_t state = 0; // Iterator state
     node_t *child = hashtable_iterate(node->payload.dirhash, &state);
     while (child) {
+        COST(visits, 1);
+        COST(compares, 1);
         if (strcmp(child->name, name) == 0) {
             /* We found a node with the requested name */
             *num = *num + 1;
-            array = (array == NULL) ? malloc_or_die(sizeof(node_t *))
-                                    : realloc_or_die(array, (*num) * sizeof(node_t *));
+            array = (array == NULL)
+                    ? ALLOC_TAG(AllocResults, malloc_or_die(sizeof(node_t *)))
+                    : realloc_or_die(array, (*num) * sizeof(node_t *));
             array[*num - 1] = child;
         }
-        /* Check subdirs */
-        if (child->type == Dir) {
+        /* Check subdirs, skipping empty ones */
+        if (child->type == Dir
+            && child->stats.files + child->stats.dirs > 0) {
             array = fs_find_r(child, name, num, array);
         }
         child = hashtable_iterate(node->payload.dirhash, &state);
     }
     return array;
 }
+
+/**
+ * Return the children of a directory sorted by name, and their number.
+ * The array is owned by the directory: it is built on first use and then
+ * kept sorted by fs_create and fs_delete, so paging through a large
+ * directory does not sort it again on every request.
+ */
+node_t **fs_list_dir(node_t *dir, size_t *num) {
+    if (dir->type != Dir) {
+        /* This isn't a directory */
+        return NULL;
+    }
+    *num = hashtable_get_size(dir->payload.dirhash);
+    if (dir->listing == NULL) {
+        size_t state = 0, i = 0;
+        dir->listing = ALLOC_TAG(AllocTable, malloc_or_die(
+            (*num > 0 ? *num : 1) * sizeof(node_t *)));
+        node_t *child = hashtable_iterate(dir->payload.dirhash, &state);
+        while (child) {
+            dir->listing[i++] = child;
+            child = hashtable_iterate(dir->payload.dirhash, &state);
+        }
+        qsort(dir->listing, *num, sizeof(node_t *), compare_node);
+    }
+    return dir->listing;
+}
+
+/**
+ * Return the position of the first entry of a sorted listing whose name
+ * follows the given cursor (binary search), 0 if cursor is NULL
+ */
+size_t fs_list_seek(node_t **list, size_t num, char *cursor) {
+    size_t lo = 0, hi = num;
+    if (cursor == NULL) return 0;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        COST(compares, 1);
+        if (strcmp(list[mid]->name, cursor) <= 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/**
+ * Get the aggregate counters of the subtree rooted at node, in O(1)
+ */
+node_stats_t *fs_get_stats(node_t *node) {
+    return &node->stats;
+}
+
+/**
+ * Set the logical clock stamped on the following changes, e.g. the
+ * sequence number of the command being executed. It must not go back.
+ */
+void fs_set_clock(uint32_t clock) {
+    fs_clock = clock;
+}
+
+/**
+ * Find resources changed after the given clock, given a starting node.
+ * Subtrees without changes are skipped without being visited.
+ */
+node_t **fs_changed_since(node_t *node, uint32_t clock, size_t *num,
+                          node_t **array) {
+    COST(visits, 1);
+    if (node->subtree_mtime <= clock) return array;
+    if (node->mtime > clock) {
+        /* We found a changed node */
+        *num = *num + 1;
+        array = (array == NULL)
+                ? ALLOC_TAG(AllocResults, malloc_or_die(sizeof(node_t *)))
+                : realloc_or_die(array, (*num) * sizeof(node_t *));
+        array[*num - 1] = node;
+    }
+    if (node->type == Dir) {
+        size_t state = 0; // Iterator state
+        node_t *child = hashtable_iterate(node->payload.dirhash, &state);
+        while (child) {
+            array = fs_changed_since(child, clock, num, array);
+            child = hashtable_iterate(node->payload.dirhash, &state);
+        }
+    }
+    return array;
+}
+
+/**
+ * Get the digest of the subtree rooted at node: files hash their content,
+ * directories the names and digests of their children, in any order.
+ * Changes only mark the digests up the parent chain as stale, they are
+ * recomputed here on demand, visiting only the stale nodes.
+ */
+uint64_t fs_get_hash(node_t *node) {
+    if (!node->hash_valid) {
+        COST(visits, 1);
+        if (node->type == File) {
+            node->hash = fs_hash_mix(hashtable_hash(node->payload.content)
+                                     ^ HASH_TAG_FILE);
+        } else {
+            uint64_t sum = HASH_TAG_DIR;
+            size_t state = 0; // Iterator state
+            node_t *child = hashtable_iterate(node->payload.dirhash, &state);
+            while (child) {
+                /* Addition makes it independent of the iteration order */
+                sum += fs_hash_mix(hashtable_hash(child->name)
+                                   + fs_get_hash(child));
+                child = hashtable_iterate(node->payload.dirhash, &state);
+            }
+            node->hash = fs_hash_mix(sum);
+        }
+        node->hash_valid = true;
+    }
+    return node->hash;
+}
+
+/**
+ * Compare two subtrees, return the paths where they differ, relative to
+ * a and b, and their number. Only the directories whose digests differ
+ * are visited, so the cost is proportional to the differences.
+ */
+char **fs_diff(node_t *a, node_t *b, size_t *num) {
+    char path[(MAX_NAMELENGHT + 1) * MAX_DEPTH + 1] = "";
+    return fs_diff_r(a, b, path, 0, NULL, num);
+}
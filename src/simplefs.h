@@ -24,6 +24,8 @@
 #include <stdbool.h>
 #include "utils.h"
 #include "hashtable.h"
+#include "handle.h"
+#include "watch.h"
 
 /****************************************************************************
  * Pre-processor Definitions
@@ -46,11 +48,29 @@ typedef union {
     char                *content;
 } node_data_u;
 
+/* Subtree aggregates */
+typedef struct _node_stats {
+    uint32_t            files;          /* Files below the node */
+    uint32_t            dirs;           /* Dirs below the node */
+    uint64_t            bytes;          /* Content bytes of the subtree: a
+                                         * file counts its own content */
+    uint16_t            height;         /* Levels below the node */
+    uint32_t            handles;        /* Open handles below the node */
+} node_stats_t;
+
 /* FS tree node */
 typedef struct _node {
     char                *name;
     struct _node        *parent;
     node_data_u         payload;
+    struct _node        **listing;      /* Sorted children, NULL if not built */
+    node_stats_t        stats;
+    handle_entry_t      *handle;        /* Open handle, NULL if none */
+    watch_t             *watchers;      /* Subscriptions on this subtree */
+    uint32_t            mtime;          /* Clock of the last change */
+    uint32_t            subtree_mtime;  /* Latest mtime in the subtree */
+    uint64_t            hash;           /* Subtree digest, own name excluded */
+    bool                hash_valid;
     uint8_t             type;
     uint16_t            depth;
 } node_t;
@@ -59,14 +79,28 @@ typedef struct _node {
  * Public Functions
  ****************************************************************************/
 char *fs_get_path(node_t *, size_t);
+bool fs_is_attached(node_t *);
 char *fs_get_file_content(node_t *);
 uint8_t fs_get_type(node_t *);
 bool fs_set_file_content(node_t *, char *);
 bool fs_create(node_t *, char *, uint8_t);
 bool fs_delete(node_t *, bool);
+bool fs_detach(node_t *, bool);
+bool fs_attach(node_t *, node_t *);
+void fs_free(node_t *);
+void fs_free_later(node_t *);
+size_t fs_reclaim(size_t);
+char *fs_swap_file_content(node_t *, char *);
 void fs_destroy_root(node_t *);
 node_t **fs_find_r(node_t *, char *, size_t *, node_t **);
 node_t *fs_find_in_dir(node_t *, char *);
 node_t *fs_new_root(void);
+node_t **fs_list_dir(node_t *, size_t *);
+size_t fs_list_seek(node_t **, size_t, char *);
+node_stats_t *fs_get_stats(node_t *);
+void fs_set_clock(uint32_t);
+node_t **fs_changed_since(node_t *, uint32_t, size_t *, node_t **);
+uint64_t fs_get_hash(node_t *);
+char **fs_diff(node_t *, node_t *, size_t *);
 
 #endif //API_SIMPLEFS_H
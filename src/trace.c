@@ -0,0 +1,135 @@
+/*
+ * Copyright 2017 Francesco Circhetta
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/****************************************************************************
+ * Included Files
+ ****************************************************************************/
+#include <string.h>
+
+#include "utils.h"
+#include "trace.h"
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+#define TRACE_FORMAT "slow %lu %llu parse=%llu resolve=%llu execute=%llu " \
+    "format=%llu output=%llu depth=%u %s\n"
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+/**
+ * Create the phase timers, for commands slower than threshold nanoseconds
+ */
+trace_t *trace_create(uint64_t threshold) {
+    trace_t *t = calloc_or_die(1, sizeof(trace_t));
+    t->threshold = threshold;
+    return t;
+}
+
+/**
+ * Start timing a command at the given clock, in the parse phase
+ */
+void trace_begin(trace_t *t, uint64_t now) {
+    memset(t->phases, 0, sizeof(t->phases));
+    t->start = t->last = now;
+    t->phase = PhaseParse;
+    t->depth = 0;
+}
+
+/**
+ * Charge the time since the last switch to the current phase, and enter
+ * another one. Does nothing if t is NULL, so that callers don't need to
+ * check whether tracing is on.
+ */
+void trace_phase(trace_t *t, uint8_t phase) {
+    if (t == NULL || t->phase == phase) return;
+    uint64_t now = clock_ns();
+    t->phases[t->phase] += now - t->last;
+    t->last = now;
+    t->phase = phase;
+}
+
+/**
+ * Note the depth of a path resolved by the command
+ */
+void trace_depth(trace_t *t, uint16_t depth) {
+    if (t != NULL && depth > t->depth) {
+        t->depth = depth;
+    }
+}
+
+/**
+ * Stop timing the command at the given clock. If it was slow, keep it in
+ * the ring, overwriting the oldest entry: line holds its len bytes, with
+ * NULs left by the tokenizer.
+ * Return true if the command was slow.
+ */
+bool trace_end(trace_t *t, uint64_t now, uint32_t seq, const char *line,
+               size_t len) {
+    t->phases[t->phase] += now - t->last;
+    if (now - t->start < t->threshold) return false;
+    trace_entry_t *entry = &t->ring[t->recorded++ % TRACE_RING];
+    entry->seq = seq;
+    entry->depth = t->depth;
+    entry->total = now - t->start;
+    memcpy(entry->phases, t->phases, sizeof(t->phases));
+    if (len > TRACE_COMMAND_LENGTH - 1) {
+        len = TRACE_COMMAND_LENGTH - 1;
+    }
+    for (size_t i = 0; i < len; i++) {
+        entry->command[i] = line[i] == '\0' || line[i] == '\n' ? ' '
+                                                               : line[i];
+    }
+    while (len > 0 && entry->command[len - 1] == ' ') len--;
+    entry->command[len] = '\0';
+    return true;
+}
+
+/**
+ * Print the slow commands recorded since the last flush and still in the
+ * ring, oldest first, each line preceded by prefix
+ * Return the number of lines printed
+ */
+size_t trace_flush(trace_t *t, FILE *out, const char *prefix) {
+    size_t lines = 0;
+    if (t->recorded - t->flushed > TRACE_RING) {
+        /* Overwritten */
+        t->flushed = t->recorded - TRACE_RING;
+    }
+    for (; t->flushed < t->recorded; t->flushed++, lines++) {
+        trace_entry_t *entry = &t->ring[t->flushed % TRACE_RING];
+        fprintf(out, "%s", prefix);
+        fprintf(out, TRACE_FORMAT, (unsigned long) entry->seq,
+                (unsigned long long) entry->total,
+                (unsigned long long) entry->phases[PhaseParse],
+                (unsigned long long) entry->phases[PhaseResolve],
+                (unsigned long long) entry->phases[PhaseExecute],
+                (unsigned long long) entry->phases[PhaseFormat],
+                (unsigned long long) entry->phases[PhaseOutput],
+                (unsigned) entry->depth, entry->command);
+    }
+    return lines;
+}
+
+/**
+ * Destroy the phase timers
+ */
+void trace_destroy(trace_t *t) {
+    my_free(t);
+}
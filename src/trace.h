@@ -0,0 +1,81 @@
+/*
+ * Copyright 2017 Francesco Circhetta
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef API_TRACE_H
+#define API_TRACE_H
+
+/****************************************************************************
+ * Included Files
+ ****************************************************************************/
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+#define TRACE_RING 64 /* Slow commands kept */
+#define TRACE_COMMAND_LENGTH 64
+
+/****************************************************************************
+* Public Types
+****************************************************************************/
+/* Command phase */
+enum {
+    PhaseParse,
+    PhaseResolve,       /* Path lookup */
+    PhaseExecute,       /* Filesystem operation */
+    PhaseFormat,        /* Building and sorting results */
+    PhaseOutput,        /* Responses, events and replication */
+    PhaseCount,
+};
+
+/* Slow command */
+typedef struct _trace_entry {
+    uint32_t            seq;
+    uint16_t            depth;          /* Deepest path resolved */
+    uint64_t            total;
+    uint64_t            phases[PhaseCount];
+    char                command[TRACE_COMMAND_LENGTH];
+} trace_entry_t;
+
+/* Phase timers of the current command, and the latest slow commands */
+typedef struct _trace {
+    uint64_t            threshold;      /* Slow command, nanoseconds */
+    uint64_t            start;
+    uint64_t            last;           /* When the current phase began */
+    uint8_t             phase;
+    uint16_t            depth;
+    uint64_t            phases[PhaseCount];
+    uint64_t            recorded;       /* Slow commands seen */
+    uint64_t            flushed;        /* Slow commands printed */
+    trace_entry_t       ring[TRACE_RING];
+} trace_t;
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+trace_t *trace_create(uint64_t);
+void trace_begin(trace_t *, uint64_t);
+void trace_phase(trace_t *, uint8_t);
+void trace_depth(trace_t *, uint16_t);
+bool trace_end(trace_t *, uint64_t, uint32_t, const char *, size_t);
+size_t trace_flush(trace_t *, FILE *, const char *);
+void trace_destroy(trace_t *);
+
+#endif //API_TRACE_H
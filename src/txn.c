@@ -0,0 +1,122 @@
+/*
+ * Copyright 2017 Francesco Circhetta
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/****************************************************************************
+ * Included Files
+ ****************************************************************************/
+#include "txn.h"
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+#define TXN_INITIAL_CAPACITY 16
+
+/****************************************************************************
+ * Private Functions
+ ****************************************************************************/
+/**
+ * Append a record to the undo log
+ */
+static txn_record_t *txn_append(txn_t *txn, uint8_t type, node_t *node) {
+    if (txn->size == txn->capacity) {
+        txn->capacity *= 2;
+        txn->log = realloc_or_die(txn->log,
+                                  txn->capacity * sizeof(txn_record_t));
+    }
+    txn_record_t *record = &txn->log[txn->size++];
+    record->type = type;
+    record->node = node;
+    return record;
+}
+
+/**
+ * Deallocate the transaction
+ */
+static void txn_destroy(txn_t *txn) {
+    my_free(txn->log);
+    my_free(txn);
+}
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+/**
+ * Start a new transaction with an empty undo log
+ */
+txn_t *txn_begin(void) {
+    txn_t *txn = malloc_or_die(sizeof(txn_t));
+    txn->size = 0;
+    txn->capacity = TXN_INITIAL_CAPACITY;
+    txn->log = malloc_or_die(txn->capacity * sizeof(txn_record_t));
+    return txn;
+}
+
+/**
+ * Record that node has been created
+ */
+void txn_log_create(txn_t *txn, node_t *node) {
+    txn_append(txn, TxnCreate, node);
+}
+
+/**
+ * Record that the content of node has been replaced. The transaction takes
+ * ownership of the old content (see fs_swap_file_content).
+ */
+void txn_log_write(txn_t *txn, node_t *node, char *old_content) {
+    txn_append(txn, TxnWrite, node)->undo.content = old_content;
+}
+
+/**
+ * Record that node has been detached from parent. The transaction takes
+ * ownership of the subtree (see fs_detach).
+ */
+void txn_log_delete(txn_t *txn, node_t *node, node_t *parent) {
+    txn_append(txn, TxnDelete, node)->undo.parent = parent;
+}
+
+/**
+ * Make the changes permanent: release what the undo log holds
+ */
+void txn_commit(txn_t *txn) {
+    for (size_t i = 0; i < txn->size; i++) {
+        txn_record_t *record = &txn->log[i];
+        if (record->type == TxnWrite) {
+            my_free(record->undo.content);
+        } else if (record->type == TxnDelete) {
+            fs_free_later(record->node);
+        }
+    }
+    txn_destroy(txn);
+}
+
+/**
+ * Roll back every change, newest first, in O(changes)
+ */
+void txn_abort(txn_t *txn) {
+    for (size_t i = txn->size; i > 0; i--) {
+        txn_record_t *record = &txn->log[i - 1];
+        if (record->type == TxnCreate) {
+            fs_delete(record->node, false);
+        } else if (record->type == TxnWrite) {
+            my_free(fs_swap_file_content(record->node, record->undo.content));
+        } else {
+            fs_attach(record->undo.parent, record->node);
+        }
+    }
+    txn_destroy(txn);
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright 2017 Francesco Circhetta
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef API_TXN_H
+#define API_TXN_H
+
+/****************************************************************************
+ * Included Files
+ ****************************************************************************/
+#include <stddef.h>
+#include "simplefs.h"
+
+/****************************************************************************
+* Public Types
+****************************************************************************/
+/* Undo log record type */
+enum {
+    TxnCreate,
+    TxnWrite,
+    TxnDelete,
+};
+
+/* Undo log record */
+typedef struct _txn_record {
+    uint8_t             type;
+    node_t              *node;
+    union {
+        char            *content;       /* TxnWrite: previous content */
+        node_t          *parent;        /* TxnDelete: former directory */
+    } undo;
+} txn_record_t;
+
+/* Transaction */
+typedef struct _txn {
+    size_t              size;
+    size_t              capacity;
+    txn_record_t        *log;
+} txn_t;
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+txn_t *txn_begin(void);
+void txn_log_create(txn_t *, node_t *);
+void txn_log_write(txn_t *, node_t *, char *);
+void txn_log_delete(txn_t *, node_t *, node_t *);
+void txn_commit(txn_t *);
+void txn_abort(txn_t *);
+
+#endif //API_TXN_H
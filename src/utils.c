@@ -17,14 +17,292 @@
 /****************************************************************************
  * Included Files
  ****************************************************************************/
+#if defined(__unix__) || defined(__APPLE__)
+#define _POSIX_C_SOURCE 200809L
+#define HAVE_POSIX
+#endif
+#ifdef HAVE_IO_URING
+#define _DEFAULT_SOURCE /* syscall */
+#endif
 #include <stdio.h>
+#include <stdbool.h>
 #include <string.h>
+#include <time.h>
+#ifdef HAVE_POSIX
+#include <errno.h>
+#include <unistd.h>
+#endif
+#ifdef HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
 #include "utils.h"
 
 /****************************************************************************
  * Pre-processor Definitions
  ****************************************************************************/
 #define MIN_CHUNK 64
+#define INPUT_CHUNK 262144
+#define INPUT_RING_ENTRIES 2
+
+#ifdef ALLOC_STATS
+/* Room for the header of a block, keeping the alignment of malloc */
+#define ALLOC_HEADER 16
+#define ALLOC_SIZE(size) ((size) + ALLOC_HEADER)
+#else
+#define ALLOC_SIZE(size) (size)
+#endif
+
+/****************************************************************************
+ * Private Types
+ ****************************************************************************/
+#ifdef HAVE_IO_URING
+/* Rings shared with the kernel, to read the next block of input while the
+ * current one is parsed */
+typedef struct _input_ring {
+    int                 fd;             /* -1 if not set up or unusable */
+    bool                tried;          /* Setup attempted */
+    bool                pending;        /* A read is in flight */
+    uint8_t             next;           /* Block the pending read fills */
+    unsigned            *sq_tail;
+    unsigned            *sq_mask;
+    unsigned            *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned            *cq_head;
+    unsigned            *cq_tail;
+    unsigned            *cq_mask;
+    struct io_uring_cqe *cqes;
+} input_ring_t;
+#endif
+
+#ifdef ALLOC_STATS
+/* Stored before every block */
+typedef struct _alloc_header {
+    size_t              size;
+    uint8_t             category;
+} alloc_header_t;
+#endif
+
+/****************************************************************************
+ * Public Data
+ ****************************************************************************/
+cost_t cost;
+
+#ifdef ALLOC_STATS
+uint8_t alloc_category = AllocOther;
+#endif
+
+/****************************************************************************
+ * Private Data
+ ****************************************************************************/
+/* Input read ahead of the current line: one block is parsed while the
+ * other one is filled, if io_uring is available */
+static char input_blocks[2][INPUT_CHUNK];
+static char *input = input_blocks[0];
+static size_t input_pos = 0;
+static size_t input_len = 0;
+
+#ifdef HAVE_IO_URING
+static input_ring_t input_ring = { .fd = -1 };
+#endif
+
+#ifdef ALLOC_STATS
+static alloc_stats_t alloc_stats[AllocCount];
+#endif
+
+/****************************************************************************
+ * Private Functions
+ ****************************************************************************/
+#ifdef HAVE_IO_URING
+/**
+ * Map a ring shared with the kernel
+ * Return NULL if failed
+ */
+static char *input_ring_map(size_t size, off_t offset) {
+    void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                     input_ring.fd, offset);
+    return ptr != MAP_FAILED ? ptr : NULL;
+}
+
+/**
+ * Stop using the rings: reads go through read() from now on
+ */
+static void input_ring_close(void) {
+    close(input_ring.fd);
+    input_ring.fd = -1;
+    input_ring.pending = false;
+}
+
+/**
+ * Set up the rings used to read stdin ahead
+ * Return true if succeeded, false if the kernel cannot do it
+ */
+static bool input_ring_setup(void) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    input_ring.tried = true;
+    input_ring.fd = (int) syscall(__NR_io_uring_setup, INPUT_RING_ENTRIES, &p);
+    if (input_ring.fd < 0) return false;
+    if (input_ring.fd == STDIN_FILENO) {
+        /* Stdin was closed, the ring took its place */
+        input_ring_close();
+        return false;
+    }
+    char *sq = input_ring_map(p.sq_off.array + p.sq_entries * sizeof(unsigned),
+                              IORING_OFF_SQ_RING);
+    char *cq = input_ring_map(p.cq_off.cqes
+                              + p.cq_entries * sizeof(struct io_uring_cqe),
+                              IORING_OFF_CQ_RING);
+    char *sqes = input_ring_map(p.sq_entries * sizeof(struct io_uring_sqe),
+                                IORING_OFF_SQES);
+    /* Reading at the current position of pipes and terminals needs 5.6 */
+    if (sq == NULL || cq == NULL || sqes == NULL
+        || !(p.features & IORING_FEAT_RW_CUR_POS)) {
+        input_ring_close();
+        return false;
+    }
+    input_ring.sq_tail = (unsigned *) (sq + p.sq_off.tail);
+    input_ring.sq_mask = (unsigned *) (sq + p.sq_off.ring_mask);
+    input_ring.sq_array = (unsigned *) (sq + p.sq_off.array);
+    input_ring.sqes = (struct io_uring_sqe *) sqes;
+    input_ring.cq_head = (unsigned *) (cq + p.cq_off.head);
+    input_ring.cq_tail = (unsigned *) (cq + p.cq_off.tail);
+    input_ring.cq_mask = (unsigned *) (cq + p.cq_off.ring_mask);
+    input_ring.cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+    return true;
+}
+
+/**
+ * Ask the kernel to read the next block of stdin into the given block
+ * Return true if succeeded, false if failed
+ */
+static bool input_ring_submit(uint8_t block) {
+    unsigned tail = *input_ring.sq_tail;
+    unsigned index = tail & *input_ring.sq_mask;
+    struct io_uring_sqe *sqe = &input_ring.sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = STDIN_FILENO;
+    sqe->addr = (uint64_t) (uintptr_t) input_blocks[block];
+    sqe->len = INPUT_CHUNK;
+    sqe->off = (uint64_t) -1; /* Current position */
+    input_ring.sq_array[index] = index;
+    __atomic_store_n(input_ring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+    long n;
+    do {
+        n = syscall(__NR_io_uring_enter, input_ring.fd, 1, 0, 0, NULL, 0);
+    } while (n < 0 && errno == EINTR);
+    if (n != 1) {
+        /* Take the entry back, nothing was submitted */
+        __atomic_store_n(input_ring.sq_tail, tail, __ATOMIC_RELEASE);
+        return false;
+    }
+    input_ring.pending = true;
+    input_ring.next = block;
+    return true;
+}
+
+/**
+ * Wait for the pending read
+ * Return its result: the length read, or a negative errno
+ */
+static int input_ring_wait(void) {
+    unsigned head = *input_ring.cq_head;
+    while (head == __atomic_load_n(input_ring.cq_tail, __ATOMIC_ACQUIRE)) {
+        long n = syscall(__NR_io_uring_enter, input_ring.fd, 0, 1,
+                         IORING_ENTER_GETEVENTS, NULL, 0);
+        if (n < 0 && errno != EINTR) return -errno;
+    }
+    int res = input_ring.cqes[head & *input_ring.cq_mask].res;
+    __atomic_store_n(input_ring.cq_head, head + 1, __ATOMIC_RELEASE);
+    input_ring.pending = false;
+    return res;
+}
+
+/**
+ * Take the next block of input from the ring, and have the kernel fill
+ * the other block meanwhile
+ * Return true if succeeded, false if the ring cannot read stdin: nothing
+ * was read then, and read() takes over
+ */
+static bool input_ring_fill(void) {
+    if (!input_ring.tried && !input_ring_setup()) return false;
+    if (input_ring.fd < 0) return false;
+    if (!input_ring.pending
+        && !input_ring_submit(input == input_blocks[0] ? 1 : 0)) {
+        input_ring_close();
+        return false;
+    }
+    int n = input_ring_wait();
+    if (n < 0) {
+        /* A failed read consumes no input */
+        input_ring_close();
+        return false;
+    }
+    input = input_blocks[input_ring.next];
+    input_len = (size_t) n;
+    if (n > 0) {
+        /* Read ahead: a failure here shows up again on the next fill */
+        input_ring_submit(input_ring.next ^ 1);
+    }
+    return true;
+}
+#endif
+
+/**
+ * Read the next block of input, as much as is available up to INPUT_CHUNK
+ * bytes, without waiting for more. Return its length, 0 at end of input.
+ * With io_uring, the block after it is already being read meanwhile.
+ */
+static size_t input_fill(void) {
+    input_pos = 0;
+    /* Responses so far are not held back while waiting for more commands */
+    fflush(stdout);
+#ifdef HAVE_IO_URING
+    if (input_ring_fill()) return input_len;
+#endif
+#ifdef HAVE_POSIX
+    ssize_t n;
+    do {
+        n = read(STDIN_FILENO, input, INPUT_CHUNK);
+    } while (n < 0 && errno == EINTR);
+    input_len = n > 0 ? (size_t) n : 0;
+#else
+    /* A line at a time: fread would wait for a whole block */
+    input_len = fgets(input, INPUT_CHUNK, stdin) ? strlen(input) : 0;
+#endif
+    return input_len;
+}
+
+#ifdef ALLOC_STATS
+/**
+ * Charge a new block of size bytes to its category, and return the
+ * address given to the caller, past the header.
+ */
+static void *alloc_account(void *ptr, size_t size, uint8_t category) {
+    alloc_header_t *header = ptr;
+    alloc_stats_t *stats = &alloc_stats[category];
+    header->size = size;
+    header->category = category;
+    stats->count++;
+    stats->bytes += size;
+    stats->live += size;
+    if (stats->live > stats->peak)
+        stats->peak = stats->live;
+    return (char *) ptr + ALLOC_HEADER;
+}
+
+/**
+ * Take a block back from its category, and return the address given by
+ * the allocator.
+ */
+static alloc_header_t *alloc_unaccount(void *ptr) {
+    alloc_header_t *header = (alloc_header_t *) ((char *) ptr - ALLOC_HEADER);
+    alloc_stats[header->category].live -= header->size;
+    return header;
+}
+#endif
 
 /****************************************************************************
  * Public Functions
@@ -34,9 +312,14 @@
  * malloc() wrapper: crash on memory allocation failure!
  */
 inline void *malloc_or_die(size_t size) {
-    void *ptr = malloc(size);
+    void *ptr = malloc(ALLOC_SIZE(size));
+    COST(allocs, 1);
     if (ptr == NULL)
         exit(-1);
+#ifdef ALLOC_STATS
+    ptr = alloc_account(ptr, size, alloc_category);
+    alloc_category = AllocOther;
+#endif
     return ptr;
 }
 
@@ -44,9 +327,20 @@ inline void *malloc_or_die(size_t size) {
  * calloc() wrapper: crash on memory allocation failure!
  */
 inline void *calloc_or_die(size_t num, size_t size) {
+#ifdef ALLOC_STATS
+    if (size != 0 && num > (SIZE_MAX - ALLOC_HEADER) / size)
+        exit(-1);
+    void *ptr = calloc(1, ALLOC_SIZE(num * size));
+#else
     void *ptr = calloc(num, size);
+#endif
+    COST(allocs, 1);
     if (ptr == NULL)
         exit(-1);
+#ifdef ALLOC_STATS
+    ptr = alloc_account(ptr, num * size, alloc_category);
+    alloc_category = AllocOther;
+#endif
     return ptr;
 }
 
@@ -54,9 +348,23 @@ inline void *calloc_or_die(size_t num, size_t size) {
  * realloc() wrapper: crash on memory allocation failure!
  */
 inline void *realloc_or_die(void *block, size_t size) {
-    void *ptr = realloc(block, size);
+#ifdef ALLOC_STATS
+    /* A block keeps its category */
+    uint8_t category = alloc_category;
+    if (block != NULL) {
+        alloc_header_t *header = alloc_unaccount(block);
+        category = header->category;
+        block = header;
+    }
+#endif
+    void *ptr = realloc(block, ALLOC_SIZE(size));
+    COST(allocs, 1);
     if (ptr == NULL)
         exit(-1);
+#ifdef ALLOC_STATS
+    ptr = alloc_account(ptr, size, category);
+    alloc_category = AllocOther;
+#endif
     return ptr;
 }
 
@@ -68,6 +376,7 @@ char *my_strdup(char *str) {
     size_t len = strlen(str);
     new = calloc_or_die(len + 1, sizeof(char));
     strncpy(new, str, len);
+    COST(bytes, len);
     return new;
 }
 
@@ -79,34 +388,37 @@ int my_getline(char **line, size_t *len) {
         *len = MIN_CHUNK;
         *line = malloc_or_die(MIN_CHUNK * sizeof(char));
     }
-    size_t n_avail = *len;
-    char *read_pos = *line;
+    size_t used = 0;
     for(;;) {
-        register int c = fgetc(stdin);
+        if (input_pos == input_len && input_fill() == 0) {
+            /* Return partial line, if any.  */
+            if (used == 0)
+                return -1;
+            break;
+        }
+        /* Copy up to the end of the line, or of the block */
+        char *start = input + input_pos;
+        char *end = memchr(start, '\n', input_len - input_pos);
+        size_t n = end != NULL ? (size_t) (end - start) + 1
+                               : input_len - input_pos;
         /* We always want at least one char left in the buffer, since we
          * always NULL-terminate the line buffer.  */
-        if (n_avail < 2) {
-            *len = (*len > MIN_CHUNK) ? *len * 2 : *len + MIN_CHUNK;
-            n_avail = *len + *line - read_pos;
+        if (used + n + 1 > *len) {
+            while (used + n + 1 > *len) {
+                *len = (*len > MIN_CHUNK) ? *len * 2 : *len + MIN_CHUNK;
+            }
             *line = realloc_or_die(*line, *len);
-            read_pos = *len - n_avail + *line;
-        }
-        if (c == EOF) {
-            /* Return partial line, if any.  */
-            if (read_pos == *line)
-                return -1;
-            else
-                break;
         }
-        *read_pos++ = (char)c;
-        n_avail--;
-        if (c == '\n')
+        memcpy(*line + used, start, n);
+        used += n;
+        input_pos += n;
+        if (end != NULL)
             /* Return the line.  */
             break;
     }
     /* Done - NUL terminate and return the number of chars read.  */
-    *read_pos = '\0';
-    return read_pos - (*line);
+    (*line)[used] = '\0';
+    return (int) used;
 }
 
 /**
@@ -115,4 +427,35 @@ int my_getline(char **line, size_t *len) {
  */
 int compare_str(const void* a, const void* b) {
     return strcmp(*(const char**)a, *(const char**)b);
-}
\ No newline at end of file
+}
+
+/**
+ * Return a monotonic clock, in nanoseconds
+ */
+uint64_t clock_ns(void) {
+#ifdef HAVE_POSIX
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+#else
+    return (uint64_t) clock() * (1000000000u / CLOCKS_PER_SEC);
+#endif
+}
+
+#ifdef ALLOC_STATS
+/**
+ * free() counterpart of the allocation wrappers
+ */
+void my_free(void *ptr) {
+    if (ptr != NULL) {
+        free(alloc_unaccount(ptr));
+    }
+}
+
+/**
+ * Return the allocations of every category, indexed by category
+ */
+const alloc_stats_t *alloc_get_stats(void) {
+    return alloc_stats;
+}
+#endif
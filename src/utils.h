@@ -21,6 +21,67 @@
  * Included Files
  ****************************************************************************/
 #include <stdlib.h>
+#include <stdint.h>
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+/* Add n to one of the cost counters */
+#define COST(counter, n) (cost.counter += (n))
+
+#ifdef ALLOC_STATS
+/* Charge the allocations made by expr to the given category */
+#define ALLOC_TAG(category, expr) (alloc_category = (category), (expr))
+#else
+#define ALLOC_TAG(category, expr) (expr)
+/* Blocks from the wrappers are plain malloc blocks */
+#define my_free(ptr) free(ptr)
+#endif
+
+/****************************************************************************
+ * Public Types
+ ****************************************************************************/
+/* Work done by the process, counted in machine independent units so that
+ * tests can bound the complexity of an operation without timing it */
+typedef struct _cost {
+    uint64_t            hashes;         /* Keys hashed */
+    uint64_t            probes;         /* Hashtable slots inspected */
+    uint64_t            compares;       /* String comparisons */
+    uint64_t            visits;         /* Tree nodes visited */
+    uint64_t            bytes;          /* Bytes copied */
+    uint64_t            allocs;         /* Heap allocations */
+} cost_t;
+
+#ifdef ALLOC_STATS
+/* Allocation categories */
+enum {
+    AllocOther,
+    AllocNode,
+    AllocName,
+    AllocContent,
+    AllocTable,
+    AllocResults,
+    AllocPath,
+    AllocCount
+};
+
+/* Allocations of a category */
+typedef struct _alloc_stats {
+    uint64_t            count;          /* Blocks allocated or resized */
+    uint64_t            bytes;          /* Bytes requested */
+    uint64_t            live;           /* Bytes not freed yet */
+    uint64_t            peak;           /* Highest live */
+} alloc_stats_t;
+#endif
+
+/****************************************************************************
+ * Public Data
+ ****************************************************************************/
+extern cost_t cost;
+#ifdef ALLOC_STATS
+/* Category of the next allocation, back to AllocOther after it */
+extern uint8_t alloc_category;
+#endif
 
 /****************************************************************************
  * Public Functions
@@ -32,5 +93,10 @@ void *realloc_or_die(void *, size_t);
 char *my_strdup(char *);
 int my_getline(char **, size_t *);
 int compare_str(const void *, const void *);
+uint64_t clock_ns(void);
+#ifdef ALLOC_STATS
+void my_free(void *);
+const alloc_stats_t *alloc_get_stats(void);
+#endif
 
 #endif //API_UTILS_H
@@ -0,0 +1,166 @@
+/*
+ * Copyright 2017 Francesco Circhetta
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/****************************************************************************
+ * Included Files
+ ****************************************************************************/
+#include <string.h>
+
+#include "simplefs.h"
+#include "watch.h"
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+#define WATCH_INITIAL_CAPACITY 16
+#define WATCH_EVENTS_CHUNK 4096
+#define EVENT_FORMAT "event %lu %s %s\n"
+
+/****************************************************************************
+ * Private Data
+ ****************************************************************************/
+static const char *event_names[] = {
+    [EventCreate] = "create",
+    [EventWrite] = "write",
+    [EventDelete] = "delete",
+};
+
+/****************************************************************************
+ * Private Functions
+ ****************************************************************************/
+/**
+ * Queue one event line for delivery
+ */
+static void watch_queue(watch_table_t *t, uint32_t id, uint8_t type,
+                        char *path) {
+    size_t need = strlen(path) + sizeof(EVENT_FORMAT) + 16;
+    if (t->events_len + need > t->events_capacity) {
+        while (t->events_len + need > t->events_capacity) {
+            t->events_capacity += WATCH_EVENTS_CHUNK;
+        }
+        t->events = realloc_or_die(t->events, t->events_capacity);
+    }
+    t->events_len += sprintf(t->events + t->events_len, EVENT_FORMAT,
+                             (unsigned long) id, event_names[type], path);
+}
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+/**
+ * Create a new, empty watch registry
+ */
+watch_table_t *watch_table_create(void) {
+    watch_table_t *t = malloc_or_die(sizeof(watch_table_t));
+    t->size = 0;
+    t->capacity = WATCH_INITIAL_CAPACITY;
+    t->body = malloc_or_die(t->capacity * sizeof(watch_t *));
+    t->events = NULL;
+    t->events_len = 0;
+    t->events_capacity = 0;
+    return t;
+}
+
+/**
+ * Subscribe to the events of the subtree rooted at node, return the id of
+ * the subscription
+ */
+uint32_t watch_add(watch_table_t *t, node_t *node) {
+    if (t->size == WATCH_NONE) return WATCH_NONE;
+    if (t->size == t->capacity) {
+        t->capacity *= 2;
+        t->body = realloc_or_die(t->body, t->capacity * sizeof(watch_t *));
+    }
+    watch_t *watch = malloc_or_die(sizeof(watch_t));
+    watch->id = t->size;
+    watch->node = node;
+    watch->next = node->watchers;
+    node->watchers = watch;
+    t->body[t->size] = watch;
+    return t->size++;
+}
+
+/**
+ * Cancel a subscription
+ * Return true if succeeded, false if the id is unknown
+ */
+bool watch_remove(watch_table_t *t, uint32_t id) {
+    if (id >= t->size || t->body[id] == NULL) return false;
+    watch_t *watch = t->body[id];
+    if (watch->node != NULL) {
+        /* Unlink from the node */
+        watch_t **link = &watch->node->watchers;
+        while (*link != watch) link = &(*link)->next;
+        *link = watch->next;
+    }
+    t->body[id] = NULL;
+    my_free(watch);
+    return true;
+}
+
+/**
+ * Queue an event that happened on node for every subscription on node or
+ * on one of its ancestors. Costs O(depth), whatever the number of
+ * subscriptions; the path is only built if someone is listening. Nodes
+ * in a detached subtree raise no events.
+ */
+void watch_notify(watch_table_t *t, node_t *node, uint8_t type) {
+    char *path = NULL;
+    /* Changes inside a subtree detached by the open transaction have no
+     * path: they are dropped with it on commit and undone on rollback */
+    if (!fs_is_attached(node)) return;
+    for (node_t *cur = node; cur != NULL; cur = cur->parent) {
+        for (watch_t *watch = cur->watchers; watch; watch = watch->next) {
+            if (path == NULL) path = fs_get_path(node, 0);
+            watch_queue(t, watch->id, type, path);
+        }
+    }
+    my_free(path);
+}
+
+/**
+ * Deliver the queued events with a single write
+ */
+void watch_flush(watch_table_t *t, FILE *out) {
+    if (t->events_len > 0) {
+        fwrite(t->events, 1, t->events_len, out);
+        t->events_len = 0;
+    }
+}
+
+/**
+ * Drop the queued events
+ */
+void watch_discard(watch_table_t *t) {
+    t->events_len = 0;
+}
+
+/**
+ * Destroy the registry, detaching every node still watched
+ */
+void watch_table_destroy(watch_table_t *t) {
+    for (uint32_t i = 0; i < t->size; i++) {
+        if (t->body[i] != NULL && t->body[i]->node != NULL) {
+            t->body[i]->node->watchers = NULL;
+        }
+        my_free(t->body[i]);
+    }
+    my_free(t->body);
+    my_free(t->events);
+    my_free(t);
+}
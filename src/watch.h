@@ -0,0 +1,74 @@
+/*
+ * Copyright 2017 Francesco Circhetta
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef API_WATCH_H
+#define API_WATCH_H
+
+/****************************************************************************
+ * Included Files
+ ****************************************************************************/
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+#define WATCH_NONE UINT32_MAX
+
+/****************************************************************************
+* Public Types
+****************************************************************************/
+struct _node;
+
+/* Event type */
+enum {
+    EventCreate,
+    EventWrite,
+    EventDelete,
+};
+
+/* Subscription to the events of a subtree */
+typedef struct _watch {
+    uint32_t            id;
+    struct _node        *node;          /* NULL once the node is gone */
+    struct _watch       *next;          /* Next watcher of the same node */
+} watch_t;
+
+/* Watch registry, with the events waiting to be delivered */
+typedef struct _watch_table {
+    uint32_t            size;
+    uint32_t            capacity;
+    watch_t             **body;         /* Indexed by id */
+    char                *events;
+    size_t              events_len;
+    size_t              events_capacity;
+} watch_table_t;
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+watch_table_t *watch_table_create(void);
+uint32_t watch_add(watch_table_t *, struct _node *);
+bool watch_remove(watch_table_t *, uint32_t);
+void watch_notify(watch_table_t *, struct _node *, uint8_t);
+void watch_flush(watch_table_t *, FILE *);
+void watch_discard(watch_table_t *);
+void watch_table_destroy(watch_table_t *);
+
+#endif //API_WATCH_H
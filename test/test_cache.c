@@ -0,0 +1,51 @@
+#include "cheat.h"
+#include "cheats.h"
+#include "utils.h"
+#include "cache.h"
+
+CHEAT_DECLARE(
+    cache_t *c;
+
+    char **make_paths(size_t num) {
+        char **paths = malloc_or_die(num * sizeof(char *));
+        for (size_t i = 0; i < num; i++) {
+            paths[i] = my_strdup("/dir1/file1");
+        }
+        return paths;
+    }
+)
+
+CHEAT_SET_UP(
+    c = cache_create();
+)
+
+CHEAT_TEAR_DOWN(
+    cache_destroy(c);
+)
+
+CHEAT_TEST(test_cache_get,
+    char **paths;
+    size_t num = 0;
+    struct _node *start = (struct _node *) c;
+    cheat_assert_not(cache_get(c, "file1", start, 0, &paths, &num));
+    cache_put(c, "file1", start, 5, make_paths(2), 2);
+    // Valid while the tree didn't change after the result was built
+    cheat_assert(cache_get(c, "file1", start, 4, &paths, &num));
+    cheat_assert_size(num, 2);
+    cheat_assert_string(paths[1], "/dir1/file1");
+    cheat_assert_not(cache_get(c, "file1", start, 5, &paths, &num));
+    cheat_assert_not(cache_get(c, "file1", NULL, 4, &paths, &num));
+    cheat_assert_not(cache_get(c, "file2", start, 4, &paths, &num));
+    cheat_assert_uint64(c->hits, 1);
+    cheat_assert_uint64(c->misses, 4);
+)
+
+CHEAT_TEST(test_cache_put,
+    char **paths;
+    size_t num = 1;
+    cache_put(c, "file1", NULL, 5, make_paths(1), 1);
+    cache_put(c, "file1", NULL, 6, NULL, 0);
+    // Empty results are cached too
+    cheat_assert(cache_get(c, "file1", NULL, 5, &paths, &num));
+    cheat_assert_size(num, 0);
+)
@@ -0,0 +1,66 @@
+#include "cheat.h"
+#include "cheats.h"
+#include "simplefs.h"
+#include "handle.h"
+
+CHEAT_DECLARE(
+    node_t *root;
+    handle_table_t *t;
+)
+
+CHEAT_SET_UP(
+    root = fs_new_root();
+    t = handle_table_create();
+)
+
+CHEAT_TEAR_DOWN(
+    handle_table_destroy(t);
+    fs_destroy_root(root);
+)
+
+CHEAT_TEST(test_handle_open,
+    fs_create(root, "dir1", Dir);
+    node_t *dir1 = fs_find_in_dir(root, "dir1");
+    uint32_t h = handle_open(t, dir1);
+    cheat_assert_not_uint32(h, HANDLE_NONE);
+    cheat_assert_pointer(handle_get(t, h), dir1);
+    // Opening twice returns the same handle
+    cheat_assert_uint32(handle_open(t, dir1), h);
+    fs_delete(dir1, false);
+)
+
+CHEAT_TEST(test_handle_close,
+    uint32_t h = handle_open(t, root);
+    cheat_assert(handle_close(t, h));
+    cheat_assert_pointer(handle_get(t, h), NULL);
+    cheat_assert_pointer(root->handle, NULL);
+    cheat_assert_not(handle_close(t, h));
+)
+
+CHEAT_TEST(test_handle_delete,
+    fs_create(root, "dir1", Dir);
+    node_t *dir1 = fs_find_in_dir(root, "dir1");
+    fs_create(dir1, "file1", File);
+    uint32_t h = handle_open(t, fs_find_in_dir(dir1, "file1"));
+    fs_delete(dir1, true);
+    cheat_assert_pointer(handle_get(t, h), NULL);
+    // The slot is recycled with a new generation
+    uint32_t h2 = handle_open(t, root);
+    cheat_assert_not_uint32(h2, h);
+    cheat_assert_pointer(handle_get(t, h), NULL);
+    cheat_assert_pointer(handle_get(t, h2), root);
+)
+
+CHEAT_TEST(test_handle_free_later,
+    fs_create(root, "dir1", Dir);
+    node_t *dir1 = fs_find_in_dir(root, "dir1");
+    fs_create(dir1, "file1", File);
+    uint32_t h = handle_open(t, fs_find_in_dir(dir1, "file1"));
+    cheat_assert_uint32(fs_get_stats(root)->handles, 1);
+    // A subtree with open handles is freed at once
+    fs_detach(dir1, true);
+    cheat_assert_uint32(fs_get_stats(root)->handles, 0);
+    fs_free_later(dir1);
+    cheat_assert_pointer(handle_get(t, h), NULL);
+    cheat_assert_size(fs_reclaim(SIZE_MAX), 0);
+)
@@ -53,6 +53,41 @@ CHEAT_TEST(test_hashtable_hammer,
     }
     for (size_t i = 1; i <= 1024; i++) {
         cheat_assert_pointer(hashtable_get(t, keys[i - 1]), NULL);
-        free(keys[i - 1]);
+        my_free(keys[i - 1]);
     }
-)
\ No newline at end of file
+)
+#ifdef HASHTABLE_STATS
+CHEAT_TEST(test_hashtable_stats,
+    const hashtable_stats_t *stats = hashtable_get_stats();
+    hashtable_stats_t before = *stats;
+    char *keys[32];
+    for (size_t i = 0; i < 32; i++) {
+        keys[i] = malloc_or_die(5 * sizeof(char));
+        sprintf(keys[i], "%d", (int) i);
+        cheat_assert(hashtable_set(t, keys[i], a));
+    }
+    cheat_assert_uint64(stats->insert.count - before.insert.count, 32);
+    cheat_assert_uint64(stats->resizes - before.resizes, 1);
+    cheat_assert_pointer(hashtable_get(t, keys[0]), a);
+    cheat_assert_uint64(stats->lookup.count - before.lookup.count, 1);
+    // 32 entries in 64 slots
+    cheat_assert_uint64(stats->load[5] - before.load[5], 1);
+    for (size_t i = 0; i < 32; i++) {
+        hashtable_remove(t, keys[i]);
+        my_free(keys[i]);
+    }
+    cheat_assert_uint64(stats->load[0], before.load[0]);
+    cheat_assert_uint64(stats->load[5], before.load[5]);
+)
+#endif
+
+CHEAT_TEST(test_hashtable_costs,
+    cheat_assert(hashtable_set(t, "asdf", a));
+    cost_t before = cost;
+    cheat_assert_pointer(hashtable_get(t, "asdf"), a);
+    cheat_assert_uint64(cost.hashes - before.hashes, 1);
+    cheat_assert_uint64(cost.compares - before.compares, 1);
+    cheat_assert(cost.probes - before.probes >= 1);
+    cheat_assert_uint64(cost.allocs, before.allocs);
+    hashtable_remove(t, "asdf");
+)
@@ -0,0 +1,33 @@
+#include "cheat.h"
+#include "cheats.h"
+#include <string.h>
+#include "histogram.h"
+
+CHEAT_DECLARE(
+    histogram_t h;
+)
+
+CHEAT_SET_UP(
+    memset(&h, 0, sizeof(histogram_t));
+)
+
+CHEAT_TEST(test_hist_record,
+    for (uint64_t i = 1; i <= 100; i++) {
+        hist_record(&h, i);
+    }
+    cheat_assert_uint64(h.count, 100);
+    cheat_assert_uint64(h.sum, 5050);
+    cheat_assert_uint64(h.max, 100);
+    // Exact below 2 * HIST_SUB, within 1/HIST_SUB above
+    cheat_assert_uint64(hist_percentile(&h, 0.1), 10);
+    cheat_assert_uint64(hist_percentile(&h, 0.5), 51);
+    cheat_assert_uint64(hist_percentile(&h, 0.99), 99);
+    cheat_assert_uint64(hist_percentile(&h, 1.0), 100);
+)
+
+CHEAT_TEST(test_hist_clamp,
+    hist_record(&h, UINT64_MAX);
+    cheat_assert_uint64(h.max, ((uint64_t) 1 << HIST_MAX_BITS) - 1);
+    cheat_assert_uint64(hist_percentile(&h, 0.5), h.max);
+    cheat_assert_uint64(hist_percentile(&h, 0.0), h.max);
+)
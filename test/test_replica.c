@@ -0,0 +1,140 @@
+#include "cheat.h"
+#include "cheats.h"
+#include "replica.h"
+#include "utils.h"
+
+CHEAT_DECLARE(
+    repl_t *leader;
+    repl_t *follower;
+    repl_record_t received[4];
+    char strings[4][3][32];
+    size_t nreceived;
+
+    void collect(void *ctx, repl_record_t *record) {
+        (void) ctx;
+        received[nreceived] = *record;
+        strcpy(strings[nreceived][0], record->path);
+        strcpy(strings[nreceived][1], record->data);
+        strcpy(strings[nreceived][2], record->tenant);
+        nreceived++;
+    }
+
+    size_t lengths[4];
+
+    void measure(void *ctx, repl_record_t *record) {
+        (void) ctx;
+        lengths[nreceived++] = strlen(record->data);
+    }
+)
+
+CHEAT_SET_UP(
+    leader = repl_open("test-replica.log", ReplLeader);
+    follower = repl_open("test-replica.log", ReplFollower);
+    nreceived = 0;
+)
+
+CHEAT_TEAR_DOWN(
+    repl_close(follower);
+    repl_close(leader);
+    remove("test-replica.log");
+)
+
+CHEAT_TEST(test_repl_ship,
+    cheat_assert_not_pointer(leader, NULL);
+    cheat_assert_not_pointer(follower, NULL);
+    cheat_yield();
+    repl_log(leader, ReplCreateDir, 1, "", "/dir1", NULL);
+    repl_log(leader, ReplWrite, 3, "tenant1", "/dir1/file1", "Lorem ipsum");
+    // Nothing is shipped before a flush
+    cheat_assert_size(repl_poll(follower, collect, NULL, 0), 0);
+    cheat_assert(repl_flush(leader));
+    cheat_assert_uint32(leader->seq, 3);
+    cheat_assert_size(repl_poll(follower, collect, NULL, 0), 2);
+    cheat_assert_uint8(received[0].op, ReplCreateDir);
+    cheat_assert_uint32(received[0].seq, 1);
+    cheat_assert_string(strings[0][0], "/dir1");
+    cheat_assert_string(strings[0][1], "");
+    cheat_assert_uint8(received[1].op, ReplWrite);
+    cheat_assert_string(strings[1][0], "/dir1/file1");
+    cheat_assert_string(strings[1][1], "Lorem ipsum");
+    cheat_assert_string(strings[1][2], "tenant1");
+    cheat_assert_uint32(follower->seq, 3);
+)
+
+CHEAT_TEST(test_repl_share,
+    repl_t *shared = repl_share(leader);
+    repl_log(shared, ReplCreate, 1, "tenant1", "/file1", NULL);
+    repl_log(leader, ReplCreate, 2, "", "/file2", NULL);
+    cheat_assert(repl_flush(leader));
+    repl_close(shared);
+    // The owner knows the last record shipped by any endpoint
+    cheat_assert_uint32(leader->seq, 2);
+    cheat_assert_size(repl_poll(follower, collect, NULL, 0), 2);
+    cheat_assert_string(strings[0][0], "/file2");
+    cheat_assert_string(strings[1][0], "/file1");
+    cheat_assert_string(strings[1][2], "tenant1");
+)
+
+CHEAT_TEST(test_repl_discard,
+    repl_log(leader, ReplCreate, 1, "", "/file1", NULL);
+    repl_discard(leader);
+    repl_log(leader, ReplDelete, 2, "", "/file2", NULL);
+    cheat_assert(repl_flush(leader));
+    cheat_assert_size(repl_poll(follower, collect, NULL, 0), 1);
+    cheat_assert_uint8(received[0].op, ReplDelete);
+    cheat_assert_string(strings[0][0], "/file2");
+)
+
+CHEAT_TEST(test_repl_poll_max,
+    repl_log(leader, ReplCreate, 1, "", "/file1", NULL);
+    repl_log(leader, ReplCreate, 2, "", "/file2", NULL);
+    repl_log(leader, ReplCreate, 3, "", "/file3", NULL);
+    cheat_assert(repl_flush(leader));
+    // The rest waits for the next round
+    cheat_assert_size(repl_poll(follower, collect, NULL, 2), 2);
+    cheat_assert_uint32(follower->seq, 2);
+    cheat_assert_size(repl_poll(follower, collect, NULL, 2), 1);
+    cheat_assert_string(strings[2][0], "/file3");
+    cheat_assert_size(repl_poll(follower, collect, NULL, 2), 0);
+)
+
+CHEAT_TEST(test_repl_large_record,
+    // A record larger than the follower backlog must still get through
+    size_t size = 3 * 1024 * 1024;
+    char *data = malloc_or_die(size + 1);
+    memset(data, 'x', size);
+    data[size] = '\0';
+    repl_log(leader, ReplWrite, 1, "", "/file1", data);
+    repl_log(leader, ReplCreate, 2, "", "/file2", NULL);
+    cheat_assert(repl_flush(leader));
+    my_free(data);
+    size_t applied = 0;
+    for (int i = 0; i < 20 && applied < 2; i++)
+        applied += repl_poll(follower, measure, NULL, 0);
+    cheat_assert_size(applied, 2);
+    cheat_assert_size(lengths[0], size);
+    cheat_assert_size(lengths[1], 0);
+    cheat_assert_uint32(follower->seq, 2);
+)
+
+CHEAT_TEST(test_repl_ring,
+    repl_t *ring_leader = repl_open("shm:test-replica.ring", ReplLeader);
+    repl_t *ring_follower = repl_open("shm:test-replica.ring", ReplFollower);
+    cheat_assert_not_pointer(ring_leader, NULL);
+    cheat_assert_not_pointer(ring_follower, NULL);
+    cheat_yield();
+    repl_log(ring_leader, ReplCreateDir, 1, "", "/dir1", NULL);
+    repl_log(ring_leader, ReplWrite, 2, "tenant1", "/dir1/file1", "Lorem");
+    cheat_assert_size(repl_poll(ring_follower, collect, NULL, 0), 0);
+    cheat_assert(repl_flush(ring_leader));
+    cheat_assert_size(repl_poll(ring_follower, collect, NULL, 0), 2);
+    cheat_assert_string(strings[1][0], "/dir1/file1");
+    cheat_assert_string(strings[1][1], "Lorem");
+    cheat_assert_string(strings[1][2], "tenant1");
+    // Nothing can be shipped once the follower is gone
+    repl_close(ring_follower);
+    repl_log(ring_leader, ReplDelete, 3, "", "/dir1", NULL);
+    cheat_assert_not(repl_flush(ring_leader));
+    repl_close(ring_leader);
+    remove("test-replica.ring");
+)
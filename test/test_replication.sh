@@ -0,0 +1,23 @@
+#!/bin/bash
+# Usage: test_replication.sh <project binary>
+# Feed each replication/<name>.leader to a leader, then replication/<name>.input
+# to a follower of its log, and compare the follower output.
+
+cd "$(dirname "$0")"
+
+project=${1:-../build/src/project}
+log=$(mktemp)
+trap 'rm -f "$log"' EXIT
+
+for leader in replication/*.leader; do
+    tname=$(basename "$leader" .leader)
+    : > "$log"
+    "$project" -L "$log" < "$leader" > /dev/null || exit 1
+    out=$("$project" -F "$log" < replication/$tname.input \
+          | diff replication/$tname.output -)
+    if [ $? -ne 0 ]; then
+        printf "FAILED: %s\n%s\n" "$tname" "$out"
+        exit 1
+    fi
+    printf "OK: %s\n" "$tname"
+done
@@ -4,6 +4,46 @@
 
 CHEAT_DECLARE(
     node_t *root;
+
+    /* Create num files named 0 to num - 1 in dir */
+    void create_files(node_t *dir, size_t num) {
+        char name[24];
+        for (size_t i = 0; i < num; i++) {
+            sprintf(name, "%zu", i);
+            fs_create(dir, name, File);
+        }
+    }
+
+    /* Create a chain of depth directories below dir, return the last */
+    node_t *create_chain(node_t *dir, size_t depth) {
+        for (size_t i = 0; i < depth; i++) {
+            fs_create(dir, "dir", Dir);
+            dir = fs_find_in_dir(dir, "dir");
+        }
+        return dir;
+    }
+
+    /* Create a tree of about num nodes, fanout children per directory */
+    void create_tree(node_t *dir, size_t num, size_t fanout) {
+        char name[24];
+        for (size_t i = 0; i < fanout && num > 0; i++) {
+            size_t below = (num - 1) / fanout;
+            sprintf(name, "%zu", i);
+            fs_create(dir, name, below > 0 ? Dir : File);
+            if (below > 0) {
+                create_tree(fs_find_in_dir(dir, name), below, fanout);
+            }
+            num -= 1 + below;
+        }
+    }
+
+    /* Work done since before: every counter weighs the same */
+    uint64_t cost_since(cost_t before) {
+        return (cost.hashes - before.hashes) + (cost.probes - before.probes)
+               + (cost.compares - before.compares)
+               + (cost.visits - before.visits) + (cost.bytes - before.bytes)
+               + (cost.allocs - before.allocs);
+    }
 )
 
 CHEAT_SET_UP(
@@ -102,10 +142,10 @@ CHEAT_TEST(test_fs_get_path,
      node_t *node = fs_find_in_dir(root, "dir1");
      char *path = fs_get_path(node, 0);
      cheat_assert_string(path, "/dir1");
-     free(path);
+     my_free(path);
      path = fs_get_path(root, 0);
      cheat_assert_string(path, "/");
-     free(path);
+     my_free(path);
      fs_delete(node, true);
 )
 
@@ -176,7 +216,263 @@ CHEAT_TEST(test_fs_find_r,
          cheat_assert_pointer(res[0], file11);
          cheat_assert_pointer(res[1], file1);
      }
-     free(res);
+     my_free(res);
      fs_delete(file1, true);
      fs_delete(dir1, true);
-)
\ No newline at end of file
+)
+CHEAT_TEST(test_fs_list_dir,
+     size_t num = 0;
+     fs_create(root, "dir1", Dir);
+     fs_create(root, "c", File);
+     fs_create(root, "a", File);
+     node_t **list = fs_list_dir(root, &num);
+     cheat_assert_size(num, 3);
+     cheat_assert_string(list[0]->name, "a");
+     cheat_assert_string(list[1]->name, "c");
+     cheat_assert_string(list[2]->name, "dir1");
+     // Snapshot is kept sorted across create and delete
+     fs_create(root, "b", File);
+     fs_delete(fs_find_in_dir(root, "c"), false);
+     list = fs_list_dir(root, &num);
+     cheat_assert_size(num, 3);
+     cheat_assert_string(list[1]->name, "b");
+     cheat_assert_string(list[2]->name, "dir1");
+     cheat_assert_size(fs_list_seek(list, num, NULL), 0);
+     cheat_assert_size(fs_list_seek(list, num, "a"), 1);
+     cheat_assert_size(fs_list_seek(list, num, "bb"), 2);
+     cheat_assert_size(fs_list_seek(list, num, "z"), 3);
+     cheat_assert_pointer(fs_list_dir(list[0], &num), NULL);
+     fs_delete(fs_find_in_dir(root, "a"), false);
+     fs_delete(fs_find_in_dir(root, "b"), false);
+     fs_delete(fs_find_in_dir(root, "dir1"), false);
+)
+
+CHEAT_TEST(test_fs_get_stats,
+     fs_create(root, "dir1", Dir);
+     node_t *dir1 = fs_find_in_dir(root, "dir1");
+     fs_create(dir1, "dir2", Dir);
+     node_t *dir2 = fs_find_in_dir(dir1, "dir2");
+     fs_create(dir2, "file1", File);
+     fs_create(root, "file2", File);
+     fs_set_file_content(fs_find_in_dir(dir2, "file1"), "Lorem");
+     fs_set_file_content(fs_find_in_dir(root, "file2"), "ipsum dolor");
+     node_stats_t *stats = fs_get_stats(root);
+     cheat_assert_uint32(stats->files, 2);
+     cheat_assert_uint32(stats->dirs, 2);
+     cheat_assert_uint64(stats->bytes, 16);
+     cheat_assert_uint16(stats->height, 3);
+     cheat_assert_uint16(fs_get_stats(dir1)->height, 2);
+     cheat_assert_uint64(fs_get_stats(dir1)->bytes, 5);
+     // Removing the deepest subtree shrinks the height
+     fs_delete(dir2, true);
+     cheat_assert_uint32(stats->files, 1);
+     cheat_assert_uint32(stats->dirs, 1);
+     cheat_assert_uint64(stats->bytes, 11);
+     cheat_assert_uint16(stats->height, 1);
+     cheat_assert_uint16(fs_get_stats(dir1)->height, 0);
+     fs_delete(dir1, false);
+     fs_delete(fs_find_in_dir(root, "file2"), false);
+     cheat_assert_uint16(stats->height, 0);
+     cheat_assert_uint64(stats->bytes, 0);
+)
+
+CHEAT_TEST(test_fs_changed_since,
+     size_t nres = 0;
+     fs_set_clock(100);
+     fs_create(root, "dir1", Dir);
+     node_t *dir1 = fs_find_in_dir(root, "dir1");
+     fs_create(dir1, "file1", File);
+     fs_create(root, "dir2", Dir);
+     node_t *dir2 = fs_find_in_dir(root, "dir2");
+     fs_create(dir2, "file2", File);
+     fs_set_clock(101);
+     fs_set_file_content(fs_find_in_dir(dir1, "file1"), "Lorem");
+     node_t **res = fs_changed_since(root, 100, &nres, NULL);
+     cheat_assert_size(nres, 1);
+     cheat_assert_pointer(res[0], fs_find_in_dir(dir1, "file1"));
+     my_free(res);
+     // Deleting a child changes its directory
+     fs_set_clock(102);
+     fs_delete(fs_find_in_dir(dir2, "file2"), false);
+     nres = 0;
+     res = fs_changed_since(root, 101, &nres, NULL);
+     cheat_assert_size(nres, 1);
+     cheat_assert_pointer(res[0], dir2);
+     my_free(res);
+     nres = 0;
+     cheat_assert_pointer(fs_changed_since(root, 102, &nres, NULL), NULL);
+     cheat_assert_size(nres, 0);
+     fs_delete(dir1, true);
+     fs_delete(dir2, true);
+)
+
+CHEAT_TEST(test_fs_get_hash$diff,
+     node_t *other = fs_new_root();
+     size_t nres = 0;
+     fs_create(root, "dir1", Dir);
+     fs_create(root, "file1", File);
+     fs_create(other, "file1", File);
+     fs_create(other, "dir1", Dir);
+     cheat_assert_uint64(fs_get_hash(root), fs_get_hash(other));
+     cheat_assert_pointer(fs_diff(root, other, &nres), NULL);
+     // Digests are recomputed after a change
+     fs_set_file_content(fs_find_in_dir(root, "file1"), "Lorem");
+     cheat_assert_not_uint64(fs_get_hash(root), fs_get_hash(other));
+     fs_create(fs_find_in_dir(other, "dir1"), "file2", File);
+     char **paths = fs_diff(root, other, &nres);
+     cheat_assert_size(nres, 2);
+     if (strcmp(paths[0], "/file1") == 0) {
+         cheat_assert_string(paths[1], "/dir1/file2");
+     } else {
+         cheat_assert_string(paths[0], "/dir1/file2");
+         cheat_assert_string(paths[1], "/file1");
+     }
+     my_free(paths[0]);
+     my_free(paths[1]);
+     my_free(paths);
+     fs_set_file_content(fs_find_in_dir(other, "file1"), "Lorem");
+     fs_delete(fs_find_in_dir(fs_find_in_dir(other, "dir1"), "file2"), false);
+     cheat_assert_uint64(fs_get_hash(root), fs_get_hash(other));
+     fs_delete(fs_find_in_dir(root, "dir1"), true);
+     fs_delete(fs_find_in_dir(root, "file1"), true);
+     fs_delete(fs_find_in_dir(other, "dir1"), true);
+     fs_delete(fs_find_in_dir(other, "file1"), true);
+     fs_destroy_root(other);
+)
+
+CHEAT_TEST(test_fs_free_later,
+    fs_create(root, "dir1", Dir);
+    node_t *dir1 = fs_find_in_dir(root, "dir1");
+    fs_create(dir1, "file1", File);
+    fs_create(dir1, "file2", File);
+    fs_reclaim(SIZE_MAX);
+    fs_detach(dir1, true);
+    fs_free_later(dir1);
+    cheat_assert_uint32(fs_get_stats(root)->dirs, 0);
+    // Deallocated a slice at a time
+    cheat_assert_size(fs_reclaim(1), 1);
+    cheat_assert_size(fs_reclaim(SIZE_MAX), 2);
+    cheat_assert_size(fs_reclaim(SIZE_MAX), 0);
+)
+
+CHEAT_TEST(test_fs_costs,
+    node_t *dir = root;
+    for (int i = 0; i < 3; i++) {
+        fs_create(dir, "dir", Dir);
+        dir = fs_find_in_dir(dir, "dir");
+    }
+    fs_create(dir, "file", File);
+    node_t *file = fs_find_in_dir(dir, "file");
+    // A lookup hashes the name once
+    cost_t before = cost;
+    fs_find_in_dir(dir, "file");
+    cheat_assert_uint64(cost.hashes - before.hashes, 1);
+    cheat_assert_uint64(cost.visits - before.visits, 1);
+    // The path is built from the node and its 4 ancestors
+    before = cost;
+    char *path = fs_get_path(file, 0);
+    cheat_assert_string(path, "/dir/dir/dir/file");
+    cheat_assert_uint64(cost.visits - before.visits, 5);
+    cheat_assert_uint64(cost.allocs - before.allocs, 1);
+    my_free(path);
+    // A search visits every node below the root once
+    size_t num = 0;
+    before = cost;
+    node_t **res = fs_find_r(root, "file", &num, NULL);
+    cheat_assert_size(num, 1);
+    cheat_assert_uint64(cost.visits - before.visits, 4);
+    cheat_assert_uint64(cost.compares - before.compares, 4);
+    my_free(res);
+    // Deleting a subtree frees each of its nodes once
+    node_t *top = fs_find_in_dir(root, "dir");
+    before = cost;
+    fs_delete(top, true);
+    cheat_assert_uint64(cost.hashes - before.hashes, 1);
+    cheat_assert_uint64(cost.visits - before.visits, 4 + 1);
+)
+
+/* Complexity: sizes N, 2N and 4N, the cost must grow as expected */
+
+CHEAT_TEST(test_fs_scaling_lookup,
+    // O(1) per lookup, whatever the size of the directory
+    uint64_t per_lookup[3];
+    char name[24];
+    for (size_t k = 0; k < 3; k++) {
+        size_t num = (size_t) 128 << k;
+        create_files(root, num);
+        cost_t before = cost;
+        for (size_t i = 0; i < num; i++) {
+            sprintf(name, "%zu", i);
+            fs_find_in_dir(root, name);
+        }
+        per_lookup[k] = cost_since(before) / num;
+        for (size_t i = 0; i < num; i++) {
+            sprintf(name, "%zu", i);
+            fs_delete(fs_find_in_dir(root, name), false);
+        }
+    }
+    cheat_assert(per_lookup[1] <= per_lookup[0] * 2);
+    cheat_assert(per_lookup[2] <= per_lookup[0] * 2);
+)
+
+CHEAT_TEST(test_fs_scaling_path,
+    // Resolving a path and building it back are O(depth)
+    uint64_t walk[3], path[3];
+    for (size_t k = 0; k < 3; k++) {
+        size_t depth = (size_t) 32 << k;
+        node_t *last = create_chain(root, depth);
+        cost_t before = cost;
+        node_t *node = root;
+        while ((node = fs_find_in_dir(node, "dir")) != NULL) {
+            if (node == last) break;
+        }
+        walk[k] = cost_since(before);
+        before = cost;
+        my_free(fs_get_path(last, 0));
+        path[k] = cost_since(before);
+        fs_delete(fs_find_in_dir(root, "dir"), true);
+    }
+    for (size_t k = 1; k < 3; k++) {
+        // Twice as deep: at most 2.5 times the cost, quadratic would be 4
+        cheat_assert(walk[k] * 4 <= walk[k - 1] * 10);
+        cheat_assert(path[k] * 4 <= path[k - 1] * 10);
+    }
+)
+
+CHEAT_TEST(test_fs_scaling_find,
+    // O(size of the subtree): every node visited once
+    uint64_t find[3];
+    for (size_t k = 0; k < 3; k++) {
+        size_t num = (size_t) 1000 << k, nres = 0;
+        create_tree(root, num, 8);
+        cost_t before = cost;
+        my_free(fs_find_r(root, "0", &nres, NULL));
+        find[k] = cost_since(before);
+        cheat_assert(cost.visits - before.visits <= num);
+        for (size_t i = 0; i < 8; i++) {
+            char name[24];
+            sprintf(name, "%zu", i);
+            fs_delete(fs_find_in_dir(root, name), true);
+        }
+    }
+    for (size_t k = 1; k < 3; k++) {
+        cheat_assert(find[k] * 4 <= find[k - 1] * 10);
+    }
+)
+
+CHEAT_TEST(test_fs_scaling_delete_r,
+    // O(size of the subtree)
+    uint64_t delete_r[3];
+    for (size_t k = 0; k < 3; k++) {
+        size_t num = (size_t) 1000 << k;
+        fs_create(root, "top", Dir);
+        node_t *top = fs_find_in_dir(root, "top");
+        create_tree(top, num, 8);
+        cost_t before = cost;
+        fs_delete(top, true);
+        delete_r[k] = cost_since(before);
+    }
+    for (size_t k = 1; k < 3; k++) {
+        cheat_assert(delete_r[k] * 4 <= delete_r[k - 1] * 10);
+    }
+)
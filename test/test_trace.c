@@ -0,0 +1,58 @@
+#include "cheat.h"
+#include "cheats.h"
+#include <stdio.h>
+#include "trace.h"
+
+CHEAT_DECLARE(
+    trace_t *t;
+
+    char *flush_trace(trace_t *trace) {
+        static char buffer[1024];
+        FILE *out = tmpfile();
+        trace_flush(trace, out, "");
+        rewind(out);
+        size_t len = fread(buffer, 1, sizeof(buffer) - 1, out);
+        buffer[len] = '\0';
+        fclose(out);
+        return buffer;
+    }
+)
+
+CHEAT_SET_UP(
+    t = trace_create(100);
+)
+
+CHEAT_TEAR_DOWN(
+    trace_destroy(t);
+)
+
+CHEAT_TEST(test_trace_end,
+    char line[] = "read\0/dir1/file1\n";
+    trace_begin(t, 1000);
+    trace_depth(t, 2);
+    cheat_assert_not(trace_end(t, 1099, 1, line, sizeof(line) - 1));
+    trace_begin(t, 2000);
+    trace_depth(t, 2);
+    cheat_assert(trace_end(t, 2150, 2, line, sizeof(line) - 1));
+    cheat_assert_string(flush_trace(t), "slow 2 150 parse=150 resolve=0 "
+                        "execute=0 format=0 output=0 depth=2 read /dir1/file1\n");
+    // Flushed once
+    cheat_assert_string(flush_trace(t), "");
+)
+
+CHEAT_TEST(test_trace_phase,
+    trace_begin(t, 0);
+    trace_phase(t, PhaseExecute);
+    trace_phase(NULL, PhaseOutput);
+    cheat_assert_uint8(t->phase, PhaseExecute);
+    cheat_assert_not_uint64(t->phases[PhaseParse], 0);
+)
+
+CHEAT_TEST(test_trace_ring,
+    for (uint32_t i = 0; i < TRACE_RING + 2; i++) {
+        trace_begin(t, 0);
+        trace_end(t, 100, i, "read", 4);
+    }
+    // The oldest entries are overwritten
+    cheat_assert(strncmp(flush_trace(t), "slow 2 ", 7) == 0);
+)
@@ -0,0 +1,58 @@
+#include "cheat.h"
+#include "cheats.h"
+#include "simplefs.h"
+#include "txn.h"
+
+CHEAT_DECLARE(
+    node_t *root;
+    txn_t *txn;
+)
+
+CHEAT_SET_UP(
+    root = fs_new_root();
+    fs_create(root, "dir1", Dir);
+    fs_create(fs_find_in_dir(root, "dir1"), "file1", File);
+    fs_set_file_content(fs_find_in_dir(fs_find_in_dir(root, "dir1"), "file1"),
+                        "Lorem");
+    txn = txn_begin();
+)
+
+CHEAT_TEAR_DOWN(
+    fs_delete(fs_find_in_dir(root, "dir1"), true);
+    fs_destroy_root(root);
+)
+
+CHEAT_TEST(test_txn_abort,
+    node_t *dir1 = fs_find_in_dir(root, "dir1");
+    node_t *file1 = fs_find_in_dir(dir1, "file1");
+    fs_create(dir1, "file2", File);
+    txn_log_create(txn, fs_find_in_dir(dir1, "file2"));
+    txn_log_write(txn, file1,
+                  fs_swap_file_content(file1, my_strdup("ipsum dolor")));
+    cheat_assert_uint64(fs_get_stats(root)->bytes, 11);
+    cheat_assert(fs_detach(dir1, true));
+    txn_log_delete(txn, dir1, root);
+    cheat_assert_pointer(fs_find_in_dir(root, "dir1"), NULL);
+    cheat_assert_uint32(fs_get_stats(root)->dirs, 0);
+    txn_abort(txn);
+    // Everything is back as it was before the transaction
+    cheat_assert_pointer(fs_find_in_dir(root, "dir1"), dir1);
+    cheat_assert_pointer(fs_find_in_dir(dir1, "file2"), NULL);
+    cheat_assert_string(fs_get_file_content(file1), "Lorem");
+    cheat_assert_uint32(fs_get_stats(root)->files, 1);
+    cheat_assert_uint32(fs_get_stats(root)->dirs, 1);
+    cheat_assert_uint64(fs_get_stats(root)->bytes, 5);
+)
+
+CHEAT_TEST(test_txn_commit,
+    node_t *dir1 = fs_find_in_dir(root, "dir1");
+    node_t *file1 = fs_find_in_dir(dir1, "file1");
+    txn_log_write(txn, file1,
+                  fs_swap_file_content(file1, my_strdup("ipsum")));
+    cheat_assert(fs_detach(file1, false));
+    txn_log_delete(txn, file1, dir1);
+    txn_commit(txn);
+    cheat_assert_pointer(fs_find_in_dir(dir1, "file1"), NULL);
+    cheat_assert_uint32(fs_get_stats(root)->files, 0);
+    cheat_assert_uint64(fs_get_stats(root)->bytes, 0);
+)
@@ -0,0 +1,88 @@
+#include "cheat.h"
+#include "cheats.h"
+#include "simplefs.h"
+#include "watch.h"
+
+CHEAT_DECLARE(
+    node_t *root;
+    watch_table_t *t;
+
+    char *flush_events(watch_table_t *table) {
+        static char buffer[256];
+        FILE *out = tmpfile();
+        watch_flush(table, out);
+        rewind(out);
+        size_t len = fread(buffer, 1, sizeof(buffer) - 1, out);
+        buffer[len] = '\0';
+        fclose(out);
+        return buffer;
+    }
+)
+
+CHEAT_SET_UP(
+    root = fs_new_root();
+    t = watch_table_create();
+)
+
+CHEAT_TEAR_DOWN(
+    watch_table_destroy(t);
+    fs_destroy_root(root);
+)
+
+CHEAT_TEST(test_watch_notify,
+    fs_create(root, "dir1", Dir);
+    node_t *dir1 = fs_find_in_dir(root, "dir1");
+    fs_create(dir1, "file1", File);
+    fs_create(root, "file2", File);
+    cheat_assert_uint32(watch_add(t, dir1), 0);
+    cheat_assert_uint32(watch_add(t, root), 1);
+    watch_notify(t, fs_find_in_dir(dir1, "file1"), EventWrite);
+    watch_notify(t, fs_find_in_dir(root, "file2"), EventDelete);
+    cheat_assert_string(flush_events(t),
+                        "event 0 write /dir1/file1\n"
+                        "event 1 write /dir1/file1\n"
+                        "event 1 delete /file2\n");
+    cheat_assert_string(flush_events(t), "");
+    fs_delete(fs_find_in_dir(root, "file2"), false);
+    fs_delete(dir1, true);
+)
+
+CHEAT_TEST(test_watch_remove,
+    fs_create(root, "dir1", Dir);
+    node_t *dir1 = fs_find_in_dir(root, "dir1");
+    uint32_t id = watch_add(t, dir1);
+    cheat_assert(watch_remove(t, id));
+    cheat_assert_not(watch_remove(t, id));
+    cheat_assert_pointer(dir1->watchers, NULL);
+    watch_notify(t, dir1, EventCreate);
+    cheat_assert_string(flush_events(t), "");
+    // Deleting the node silences its subscriptions
+    id = watch_add(t, dir1);
+    fs_delete(dir1, false);
+    cheat_assert_pointer(t->body[id]->node, NULL);
+    cheat_assert(watch_remove(t, id));
+)
+
+CHEAT_TEST(test_watch_detached,
+    fs_create(root, "dir1", Dir);
+    node_t *dir1 = fs_find_in_dir(root, "dir1");
+    fs_create(dir1, "file1", File);
+    watch_add(t, dir1);
+    // Nothing is heard from a detached subtree until it is linked back
+    fs_detach(dir1, true);
+    watch_notify(t, fs_find_in_dir(dir1, "file1"), EventWrite);
+    cheat_assert_string(flush_events(t), "");
+    fs_attach(root, dir1);
+    watch_notify(t, fs_find_in_dir(dir1, "file1"), EventWrite);
+    cheat_assert_string(flush_events(t), "event 0 write /dir1/file1\n");
+    fs_delete(dir1, true);
+)
+
+CHEAT_TEST(test_watch_discard,
+    watch_add(t, root);
+    fs_create(root, "file1", File);
+    watch_notify(t, fs_find_in_dir(root, "file1"), EventCreate);
+    watch_discard(t);
+    cheat_assert_string(flush_events(t), "");
+    fs_delete(fs_find_in_dir(root, "file1"), false);
+)